@@ -1,6 +1,7 @@
 #include "cl/command_queue.hpp"
 
 #include "cl/context.hpp"
+#include "acier/algorithm.hpp"
 
 namespace cl {
 
@@ -9,6 +10,14 @@ command_queue::command_queue(weak_context ctx, device d,
   create(ctx, d, properties);
 }
 
+command_queue::command_queue(weak_context ctx, device d,
+              std::initializer_list<queue_property> properties) {
+  create(ctx, d, acier::accumulate(properties, cl_command_queue_properties(0),
+      [](cl_command_queue_properties a, queue_property b) {
+        return a | static_cast<cl_command_queue_properties>(b);
+      }));
+}
+
 command_queue::command_queue(weak_context ctx,
               cl_command_queue_properties properties) {
   auto devices = ctx.devices();
@@ -31,4 +40,12 @@ void weak_command_queue::create(weak_context ctx, device d,
   reset(id);
 }
 
+void weak_command_queue::finnish() {
+  check_error(clFinish(*this));
+}
+
+void weak_command_queue::flush() {
+  check_error(clFlush(*this));
+}
+
 }
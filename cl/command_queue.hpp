@@ -24,10 +24,31 @@ struct command_queue_traits {
 
 using event_list = std::initializer_list<event>;
 
+enum class queue_property {
+  kOutOfOrderExecution = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
+  kProfiling = CL_QUEUE_PROFILING_ENABLE,
+};
+
+// Tag requesting that a command be enqueued without creating an event. On an
+// in-order queue, commands already complete in submission order, so the
+// dependency chain the event would carry is implicit.
+constexpr struct no_event_t {} no_event {};
+
 class weak_command_queue : public base_wrapper<command_queue_traits> {
  public:
+  struct Context : property<CL_QUEUE_CONTEXT, cl_context> {};
+  struct Device : property<CL_QUEUE_DEVICE, cl_device_id> {};
+  struct ReferenceCount : property<CL_QUEUE_REFERENCE_COUNT, cl_uint> {};
+  struct Properties : property<CL_QUEUE_PROPERTIES, cl_command_queue_properties> {};
+ 
   using base_wrapper<command_queue_traits>::base_wrapper;
   
+  // Returns true if commands enqueued on this queue record profiling
+  // information in their events.
+  bool profiling() const {
+    return (get_info<Properties>() & CL_QUEUE_PROFILING_ENABLE) != 0;
+  }
+  
   template <class R, class F, class... Args>
   future<R> enqueue(F fun, event_list el, Args&&... args) {
     cl_event e;
@@ -37,7 +58,7 @@ class weak_command_queue : public base_wrapper<command_queue_traits> {
         cl_uint(el.size()),
         reinterpret_cast<const cl_event*>(event_ptr), &e, &err));
     if (err != CL_SUCCESS) throw opencl_error(err);
-    return {r, e};
+    return {r, event(e, transfer)};
   }
   template <class F, class... Args>
   event enqueue(F fun, event_list el, Args&&... args) {
@@ -49,6 +70,15 @@ class weak_command_queue : public base_wrapper<command_queue_traits> {
     if (err != CL_SUCCESS) throw opencl_error(err);
     return {e, transfer};
   }
+  template <class F, class... Args>
+  void enqueue(F fun, no_event_t, Args&&... args) {
+    cl_int err = fun(*this, std::forward<Args>(args)..., 0, nullptr, nullptr);
+    if (err != CL_SUCCESS) throw opencl_error(err);
+  }
+  
+  event enqueue_marker(event_list el = {}) {
+    return enqueue(clEnqueueMarkerWithWaitList, el);
+  }
   
   void finnish();
   void flush();
@@ -65,8 +95,41 @@ struct command_queue : shared_wrapper<weak_command_queue> {
                 cl_command_queue_properties properties = 0);
   command_queue(weak_context ctx,
                 cl_command_queue_properties properties = 0);
+  command_queue(weak_context ctx, device d,
+                std::initializer_list<queue_property> properties);
 };
 
-
+// Enqueues commands on an in-order queue without creating events, and flushes
+// the queue every |flush_interval| commands so the device starts working
+// before the whole batch is submitted. close() returns a single marker event
+// that completes once every command of the batch is done.
+class command_batch {
+ public:
+  command_batch(weak_command_queue q, size_t flush_interval)
+      : queue_(q), flush_interval_(flush_interval) {
+    assert(flush_interval_ > 0);
+  }
+  
+  template <class Command>
+  void operator()(const Command& command) {
+    command(queue_, no_event);
+    if (++pending_ == flush_interval_) {
+      queue_.flush();
+      pending_ = 0;
+    }
+  }
+  
+  event close() {
+    event e = queue_.enqueue_marker();
+    queue_.flush();
+    pending_ = 0;
+    return e;
+  }
+  
+ private:
+  weak_command_queue queue_;
+  size_t flush_interval_;
+  size_t pending_ = 0;
+};
 
 }
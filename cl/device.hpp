@@ -2,9 +2,13 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "acier/algorithm.hpp"
+#include "cl/error.hpp"
 #include "cl/wrapper.hpp"
 #include "cl/platform.hpp"
 
@@ -32,6 +36,7 @@ class device : public base_wrapper<device_traits> {
   struct GlobalMemSize : property<CL_DEVICE_GLOBAL_MEM_SIZE, cl_ulong> {};
   struct HalfFpConfig : property<CL_DEVICE_HALF_FP_CONFIG, cl_device_fp_config> {};
   struct ImageSupport : predicate<CL_DEVICE_IMAGE_SUPPORT> {};
+  struct MaxComputeUnits : property<CL_DEVICE_MAX_COMPUTE_UNITS, cl_uint> {};
   
   struct Name : property<CL_DEVICE_NAME, std::string> {};
   
@@ -44,11 +49,12 @@ class device : public base_wrapper<device_traits> {
   bool available() const { return get_info<Available>(); }
   std::string name() const { return get_info<Name>(); }
   cl_device_type type() const { return get_info<Type>(); }
+  cl_uint max_compute_units() const { return get_info<MaxComputeUnits>(); }
 };
 
 template <class Os>
 Os& operator << (Os& os, const device& d) {
-  os << d.name();
+  return os << d.name();
 }
 
 namespace filter {
@@ -81,6 +87,48 @@ struct one : count {
   one() : count(1) {}
 };
 
+// Accepts devices of any of the CL_DEVICE_TYPE_* in |types|.
+class type {
+ public:
+  type(cl_device_type types) : types_(types) {}
+  bool operator()(const device& d) const { return (d.type() & types_) != 0; }
+ private:
+  cl_device_type types_;
+};
+
+// Accepts devices whose name contains |name|.
+class name {
+ public:
+  name(std::string name) : name_(std::move(name)) {}
+  bool operator()(const device& d) const
+  { return d.name().find(name_) != std::string::npos; }
+ private:
+  std::string name_;
+};
+
+// Accepts only the |n|th device reaching it, counting from 0.
+class nth {
+ public:
+  nth(size_t n) : n_(n) {}
+  bool operator()(const device&) { return i_++ == n_; }
+ private:
+  size_t i_ = 0;
+  const size_t n_;
+};
+
+}
+
+namespace detail {
+
+inline bool accept(const device&) { return true; }
+
+// Filters are applied in order and stop at the first one rejecting |d|, so
+// that counting filters only see the devices accepted by those before them.
+template <class Filter, class... Filters>
+bool accept(const device& d, Filter&& filter, Filters&&... filters) {
+  return filter(d) && accept(d, std::forward<Filters>(filters)...);
+}
+
 }
 
 template <class... Filters>
@@ -95,8 +143,7 @@ std::vector<device> get_devices(Filters&&... filters) {
     clGetDeviceIDs(p, CL_DEVICE_TYPE_ALL, size, device_ids.data(), nullptr);
     for (auto& id : device_ids) {
       device d(id);
-      if (device::Available()(d) &&
-          acier::all_of(std::initializer_list<bool>{filters(d)...})) {
+      if (device::Available()(d) && detail::accept(d, filters...)) {
           devices.push_back(std::move(d));
       }
     }
@@ -104,6 +151,31 @@ std::vector<device> get_devices(Filters&&... filters) {
   return devices;
 }
 
+// Splits |d| into |n| sub-devices with as many compute units each, by device
+// fission. Like root devices, sub-devices aren't reference counted by
+// cl::device: they are released with the program.
+inline std::vector<device> create_sub_devices(device d, size_t n) {
+  assert(n > 0 && n <= d.max_compute_units());
+  const cl_device_partition_property properties[] = {
+    CL_DEVICE_PARTITION_EQUALLY,
+    cl_device_partition_property(d.max_compute_units() / n),
+    0
+  };
+  cl_uint size = 0;
+  cl_int err = clCreateSubDevices(d, properties, 0, nullptr, &size);
+  if (err != CL_SUCCESS) throw opencl_error(err);
+  std::vector<cl_device_id> device_ids(size);
+  err = clCreateSubDevices(d, properties, size, device_ids.data(), nullptr);
+  if (err != CL_SUCCESS) throw opencl_error(err);
+
+  // The remainder of the compute units may make an extra sub-device.
+  for (size_t i = n; i < device_ids.size(); ++i) {
+    clReleaseDevice(device_ids[i]);
+  }
+  device_ids.resize(std::min(n, device_ids.size()));
+  return std::vector<device>(device_ids.begin(), device_ids.end());
+}
+
 inline device find_default_device() {
   auto d = get_devices(filter::gpu(), filter::one());
   if (d.empty())
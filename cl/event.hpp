@@ -2,6 +2,8 @@
 
 #include <assert.h>
 
+#include <chrono>
+
 #include "acier/type_traits.hpp"
 #include "cl/wrapper.hpp"
 #include "cl/device.hpp"
@@ -24,8 +26,20 @@ class weak_event : public base_wrapper<event_traits> {
   static constexpr bool ptr_callback() { return true; }
   template <class F, class... D>
   static constexpr bool ptr_callback(D...) { return false; }
+  
+  template <cl_profiling_info i>
+  using profiling_property = detail::property<cl_profiling_info, i, cl_ulong>;
 
  public:
+  struct CommandQueue : property<CL_EVENT_COMMAND_QUEUE, cl_command_queue> {};
+  struct CommandType : property<CL_EVENT_COMMAND_TYPE, cl_command_type> {};
+  struct ExecutionStatus : property<CL_EVENT_COMMAND_EXECUTION_STATUS, cl_int> {};
+  
+  struct ProfilingQueued : profiling_property<CL_PROFILING_COMMAND_QUEUED> {};
+  struct ProfilingSubmit : profiling_property<CL_PROFILING_COMMAND_SUBMIT> {};
+  struct ProfilingStart : profiling_property<CL_PROFILING_COMMAND_START> {};
+  struct ProfilingEnd : profiling_property<CL_PROFILING_COMMAND_END> {};
+
   using native_function = void(CL_CALLBACK*)(cl_event, cl_int, void*);
   enum execution_status {
     complete = CL_COMPLETE,
@@ -45,6 +59,26 @@ class weak_event : public base_wrapper<event_traits> {
     if (err != CL_SUCCESS) throw opencl_error(err);
   }
   
+  // Device timestamps of the command, in nanoseconds. Only available once the
+  // command is complete, and if it was enqueued on a queue created with
+  // queue_property::kProfiling.
+  template <class Property, class Type = typename Property::type>
+  Type get_profiling_info() const {
+    Type info;
+    cl_int err = clGetEventProfilingInfo(get(), Property::value, sizeof(Type), &info, nullptr);
+    if (err != CL_SUCCESS) throw opencl_error(err);
+    return info;
+  }
+  cl_ulong queued_time() const { return get_profiling_info<ProfilingQueued>(); }
+  cl_ulong submit_time() const { return get_profiling_info<ProfilingSubmit>(); }
+  cl_ulong start_time() const { return get_profiling_info<ProfilingStart>(); }
+  cl_ulong end_time() const { return get_profiling_info<ProfilingEnd>(); }
+  
+  // Time spent executing the command on the device.
+  std::chrono::nanoseconds duration() const {
+    return std::chrono::nanoseconds(end_time() - start_time());
+  }
+  
   template <class F, acier::when<ptr_callback<F>()> = true>
   void bind(const F& callback, cl_int status = complete);
   template <class F, acier::when<!ptr_callback<F>()> = true>
@@ -75,7 +109,7 @@ class future {
     event_.wait();
   }
   
-  weak_event get_event() { return value_->e_; }
+  weak_event get_event() { return event_; }
   
   operator T() { return get(); }
   operator weak_event() { return get_event(); }
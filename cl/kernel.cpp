@@ -10,6 +10,18 @@ void weak_kernel::create(weak_program prog, const char* name) {
   reset(id);
 }
 
+kernel weak_kernel::clone() const {
+#ifdef CL_VERSION_2_1
+  cl_int error = 0;
+  cl_kernel id = clCloneKernel(*this, &error);
+  if (!id) throw opencl_error(error);
+  return {id, transfer};
+#else
+  program prog(get_info<Program>(), retain);
+  return kernel(prog, get_info<FunctionName>().c_str());
+#endif
+}
+
 kernel::kernel(weak_program prog, const char* name) {
   create(prog, name);
 }
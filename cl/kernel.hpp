@@ -1,10 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <tuple>
 #include <string>
 #include <initializer_list>
 
 #include "cl/wrapper.hpp"
+#include "cl/command_queue.hpp"
 #include "cl/program.hpp"
 #include "cl/memory.hpp"
 
@@ -18,6 +21,8 @@ struct kernel_traits {
   static constexpr auto release = clReleaseKernel;
 };
 
+struct kernel;
+
 class weak_kernel : public base_wrapper<kernel_traits> {
  public:
   struct FunctionName : property<CL_KERNEL_FUNCTION_NAME, std::string> {};
@@ -28,6 +33,11 @@ class weak_kernel : public base_wrapper<kernel_traits> {
  
   using base_wrapper::base_wrapper;
   
+  // Creates a new kernel object for the same function. Argument values are
+  // copied where clCloneKernel is available (OpenCL 2.1); otherwise the clone
+  // starts with no argument set.
+  kernel clone() const;
+  
   //template <class... Args>
   //event call(command_queue queue, )
   
@@ -54,7 +64,7 @@ void set_kernel_arg(weak_kernel k, size_t index, const T& v) {
 }
 
 inline void set_kernel_arg(weak_kernel k, size_t index, weak_buffer buf) {
-  cl_int error = clSetKernelArg(k, cl_uint(index), sizeof(cl_mem), buf.get());
+  cl_int error = clSetKernelArg(k, cl_uint(index), sizeof(cl_mem), &buf.get());
   check_error(error);
 }
 
@@ -66,37 +76,134 @@ void set_kernel_args(weak_kernel k,  std::index_sequence<I...>, const std::tuple
 
 }
 
+// NDRange launch of a kernel whose arguments are already set. Invoking it with
+// an event_list returns the completion event, invoking it with no_event
+// enqueues the launch without creating one.
+class kernel_command {
+ public:
+  kernel_command(weak_kernel k,
+                 std::initializer_list<size_t> global_offsets,
+                 std::initializer_list<size_t> global_size,
+                 std::initializer_list<size_t> local_size)
+      : kernel_(k),
+        dims_(cl_uint(global_size.size())),
+        has_offsets_(global_offsets.size() != 0),
+        has_local_size_(local_size.size() != 0) {
+    assert(dims_ > 0 && dims_ <= 3);
+    std::copy(global_offsets.begin(), global_offsets.end(), global_offsets_.begin());
+    std::copy(global_size.begin(), global_size.end(), global_size_.begin());
+    std::copy(local_size.begin(), local_size.end(), local_size_.begin());
+  }
+  
+  event operator()(weak_command_queue q, event_list el) const {
+    return q.enqueue(clEnqueueNDRangeKernel, el, kernel_, dims_,
+                     global_offsets(), global_size_.data(), local_size());
+  }
+  void operator()(weak_command_queue q, no_event_t) const {
+    q.enqueue(clEnqueueNDRangeKernel, no_event, kernel_, dims_,
+              global_offsets(), global_size_.data(), local_size());
+  }
+  
+ private:
+  const size_t* global_offsets() const {
+    return has_offsets_ ? global_offsets_.data() : nullptr;
+  }
+  const size_t* local_size() const {
+    return has_local_size_ ? local_size_.data() : nullptr;
+  }
+  
+  weak_kernel kernel_;
+  cl_uint dims_;
+  bool has_offsets_;
+  bool has_local_size_;
+  std::array<size_t, 3> global_offsets_ = {};
+  std::array<size_t, 3> global_size_ = {};
+  std::array<size_t, 3> local_size_ = {};
+};
+
 template <class... Args>
-auto invoke_kernel(weak_kernel k,
+kernel_command invoke_kernel(weak_kernel k,
                    std::initializer_list<size_t> global_offsets,
                    std::initializer_list<size_t> global_size,
                    std::initializer_list<size_t> local_size,
                    const std::tuple<Args...>& args) {
   detail::set_kernel_args(k, std::index_sequence_for<Args...>(), args);
-  return [k, global_offsets, global_size, local_size](weak_command_queue q, event_list el) -> event {
-    return q.enqueue(clEnqueueNDRangeKernel, el, k, global_size.size(), global_offsets.begin(), global_size.begin(), local_size.begin());
-  };
+  return {k, global_offsets, global_size, local_size};
 }
 
 template <class... Args>
-auto invoke_kernel(weak_kernel k,
+kernel_command invoke_kernel(weak_kernel k,
                    std::initializer_list<size_t> global_offsets,
                    std::initializer_list<size_t> global_size,
                    const std::tuple<Args...>& args) {
   detail::set_kernel_args(k, std::index_sequence_for<Args...>(), args);
-  return [k, global_offsets, global_size](weak_command_queue q, event_list el) -> event {
-    return q.enqueue(clEnqueueNDRangeKernel, el, k, global_size.size(), global_offsets.begin(), global_size.begin(), nullptr);
-  };
+  return {k, global_offsets, global_size, {}};
 }
 
 template <class... Args>
-auto invoke_kernel(weak_kernel k,
+kernel_command invoke_kernel(weak_kernel k,
                    std::initializer_list<size_t> global_size,
                    const std::tuple<Args...>& args) {
   detail::set_kernel_args(k, std::index_sequence_for<Args...>(), args);
-  return [k, global_size](weak_command_queue q, event_list el) -> event {
-    return q.enqueue(clEnqueueNDRangeKernel, el, k, cl_uint(global_size.size()), nullptr, global_size.begin(), nullptr);
-  };
+  return {k, {}, global_size, {}};
 }
 
+// Kernel launch whose arguments are set once, at construction, on a private
+// clone of the kernel. Launching it afterwards costs a single
+// clEnqueueNDRangeKernel, and other users of the original kernel can't
+// overwrite its arguments.
+class bound_kernel {
+ public:
+  template <class... Args>
+  bound_kernel(weak_kernel k,
+               std::initializer_list<size_t> global_size,
+               std::initializer_list<size_t> local_size,
+               const std::tuple<Args...>& args)
+      : kernel_(k.clone()),
+        command_(invoke_kernel(kernel_, {}, global_size, local_size, args)) {}
+  template <class... Args>
+  bound_kernel(weak_kernel k,
+               std::initializer_list<size_t> global_size,
+               const std::tuple<Args...>& args)
+      : bound_kernel(k, global_size, {}, args) {}
+  
+  event operator()(weak_command_queue q, event_list el) const {
+    return command_(q, el);
+  }
+  void operator()(weak_command_queue q, no_event_t) const {
+    command_(q, no_event);
+  }
+  
+ private:
+  kernel kernel_;
+  kernel_command command_;
+};
+
+// Pair of bound kernels for ping-pong iterations, where input and output swap
+// roles at every launch. |even_args| are bound to the launches of even
+// iterations and |odd_args| to the odd ones.
+class ping_pong_kernel {
+ public:
+  template <class... Args>
+  ping_pong_kernel(weak_kernel k,
+                   std::initializer_list<size_t> global_size,
+                   std::initializer_list<size_t> local_size,
+                   const std::tuple<Args...>& even_args,
+                   const std::tuple<Args...>& odd_args)
+      : kernels_{{bound_kernel(k, global_size, local_size, even_args),
+                  bound_kernel(k, global_size, local_size, odd_args)}} {}
+  template <class... Args>
+  ping_pong_kernel(weak_kernel k,
+                   std::initializer_list<size_t> global_size,
+                   const std::tuple<Args...>& even_args,
+                   const std::tuple<Args...>& odd_args)
+      : ping_pong_kernel(k, global_size, {}, even_args, odd_args) {}
+  
+  // Returns the launch of iteration |i|.
+  const bound_kernel& operator[](size_t i) const { return kernels_[i % 2]; }
+  
+ private:
+  std::array<bound_kernel, 2> kernels_;
+};
+
 }
@@ -46,4 +46,26 @@ image::image(weak_context ctx,
         host_access ha)
     : image(ctx, flags<cl_mem_flags>((memory_space ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR), da, ha), format, desc, host_ptr) {}
 
+std::vector<cl_image_format> get_supported_image_formats(
+    weak_context ctx, cl_mem_flags flags, mem_object_type type) {
+  cl_uint size = 0;
+  clGetSupportedImageFormats(ctx, flags, static_cast<cl_mem_object_type>(type),
+                             0, nullptr, &size);
+  std::vector<cl_image_format> formats(size);
+  clGetSupportedImageFormats(ctx, flags, static_cast<cl_mem_object_type>(type),
+                             size, formats.data(), nullptr);
+  return formats;
+}
+
+bool is_image_format_supported(
+    weak_context ctx, const image_format& format, mem_object_type type) {
+  for (auto& f : get_supported_image_formats(ctx, CL_MEM_READ_WRITE, type)) {
+    if (f.image_channel_order == format.image_channel_order &&
+        f.image_channel_data_type == format.image_channel_data_type) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }
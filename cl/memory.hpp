@@ -2,6 +2,9 @@
 
 #include <assert.h>
 
+#include <array>
+#include <vector>
+
 #include "cl/wrapper.hpp"
 #include "cl/device.hpp"
 #include "cl/context.hpp"
@@ -152,6 +155,17 @@ struct image : shared_wrapper<weak_image> {
         host_access ha = host_access::kReadWrite);
 };
 
+// Returns the image formats of |type| supported by |ctx| for images created
+// with |flags|.
+std::vector<cl_image_format> get_supported_image_formats(
+    weak_context ctx, cl_mem_flags flags,
+    mem_object_type type = mem_object_type::kImage2d);
+
+// Returns true if |ctx| supports read-write images of |format| and |type|.
+bool is_image_format_supported(
+    weak_context ctx, const image_format& format,
+    mem_object_type type = mem_object_type::kImage2d);
+
 enum class map_access {
   read = CL_MAP_READ,
   write = CL_MAP_WRITE,
@@ -159,10 +173,20 @@ enum class map_access {
   write_exclusive = CL_MAP_WRITE_INVALIDATE_REGION,
 };
 
+// Maps |size| elements of |b| from |offset| into host memory. The future
+// holds the mapped pointer, valid once the map is complete and until the
+// buffer is unmapped with unmap_buffer().
 template <class T>
 auto map_buffer(weak_buffer b, map_access access, size_t offset, size_t size) {
   return [b, access, offset, size](weak_command_queue q, event_list el){
-    return q.enqueue(clEnqueueMapBuffer, el, b, CL_FALSE, access, offset * sizeof(T), size * sizeof(T));
+    return q.template enqueue<T*>(clEnqueueMapBuffer, el, b, CL_FALSE,
+      static_cast<cl_map_flags>(access), offset * sizeof(T), size * sizeof(T));
+  };
+}
+
+inline auto unmap_buffer(weak_buffer b, void* ptr) {
+  return [b, ptr](weak_command_queue q, event_list el){
+    return q.enqueue(clEnqueueUnmapMemObject, el, b, ptr);
   };
 }
 
@@ -194,6 +218,28 @@ auto copy_buffer(weak_buffer src, weak_buffer dst, size_t src_offset, size_t dst
   };
 }
 
+// Reads |height| rows of |width| elements from the tightly packed 2d buffer
+// |b| into host memory with |pitch| bytes between rows.
+template <class T>
+auto read_buffer_rect(weak_buffer b, size_t width, size_t height, size_t pitch, T* ptr) {
+  std::array<size_t, 3> origin = {0, 0, 0};
+  std::array<size_t, 3> region = {width * sizeof(T), height, 1};
+  return [b, origin, region, pitch, ptr](weak_command_queue q, event_list el){
+    return q.enqueue(clEnqueueReadBufferRect, el, b, CL_FALSE, origin.data(), origin.data(), region.data(), region[0], 0, pitch, 0, reinterpret_cast<void*>(ptr));
+  };
+}
+
+// Writes |height| rows of |width| elements from host memory with |pitch|
+// bytes between rows into the tightly packed 2d buffer |b|.
+template <class T>
+auto write_buffer_rect(weak_buffer b, size_t width, size_t height, size_t pitch, const T* ptr) {
+  std::array<size_t, 3> origin = {0, 0, 0};
+  std::array<size_t, 3> region = {width * sizeof(T), height, 1};
+  return [b, origin, region, pitch, ptr](weak_command_queue q, event_list el){
+    return q.enqueue(clEnqueueWriteBufferRect, el, b, CL_FALSE, origin.data(), origin.data(), region.data(), region[0], 0, pitch, 0, reinterpret_cast<const void*>(ptr));
+  };
+}
+
 inline auto read_image(weak_image im, std::initializer_list<size_t> origin, std::initializer_list<size_t> region, size_t pitch, uint8_t* data) {
   return [im, origin, region, pitch, data](weak_command_queue q, event_list el){
     return q.enqueue(clEnqueueReadImage, el, im, CL_FALSE, origin.begin(), region.begin(), pitch, 0, data);
@@ -206,6 +252,29 @@ inline auto write_image(weak_image im, std::initializer_list<size_t> origin, std
   };
 }
 
+// Copies the |region| of |im| at |origin| into |b|, tightly packed from
+// |offset| bytes on.
+inline auto copy_image_to_buffer(weak_image im, weak_buffer b,
+    std::initializer_list<size_t> origin,
+    std::initializer_list<size_t> region,
+    size_t offset) {
+  return [im, b, origin, region, offset](weak_command_queue q, event_list el){
+    return q.enqueue(clEnqueueCopyImageToBuffer, el, im, b,
+      origin.begin(), region.begin(), offset);
+  };
+}
+
+// Inverse of copy_image_to_buffer().
+inline auto copy_buffer_to_image(weak_buffer b, weak_image im,
+    size_t offset,
+    std::initializer_list<size_t> origin,
+    std::initializer_list<size_t> region) {
+  return [b, im, offset, origin, region](weak_command_queue q, event_list el){
+    return q.enqueue(clEnqueueCopyBufferToImage, el, b, im,
+      offset, origin.begin(), region.begin());
+  };
+}
+
 template <class T>
 inline auto fill_image(weak_image im, const T& color,
     std::initializer_list<size_t> origin,
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cl/event.hpp"
+
+namespace cl {
+
+// Accumulates the device time of profiled commands under named stages, in the
+// order the stages are first recorded. Events must be complete, and come from
+// a queue created with queue_property::kProfiling.
+class profiler {
+ public:
+  struct stage {
+    std::string name;
+    std::chrono::nanoseconds total = {};
+    size_t count = 0;
+
+    std::chrono::nanoseconds average() const {
+      return count == 0 ? total : total / std::chrono::nanoseconds::rep(count);
+    }
+  };
+
+  // Adds the execution time of the command of |e| to |name|.
+  void add(const std::string& name, weak_event e) {
+    record(name, e.duration());
+  }
+  // Adds the time between the start of |first| and the end of |last| to
+  // |name|, for a stage made of several commands on the same in-order queue.
+  void add(const std::string& name, weak_event first, weak_event last) {
+    record(name, std::chrono::nanoseconds(last.end_time() - first.start_time()));
+  }
+
+  void clear() { stages_.clear(); }
+
+  const std::vector<stage>& stages() const { return stages_; }
+
+ private:
+  void record(const std::string& name, std::chrono::nanoseconds t) {
+    auto it = std::find_if(stages_.begin(), stages_.end(),
+                           [&](const stage& s) { return s.name == name; });
+    if (it == stages_.end()) {
+      stages_.push_back({name});
+      it = stages_.end() - 1;
+    }
+    it->total += t;
+    ++it->count;
+  }
+
+  std::vector<stage> stages_;
+};
+
+// Prints the average device time of every stage, in seconds.
+template <class Os>
+Os& operator << (Os& os, const profiler& p) {
+  for (auto& s : p.stages()) {
+    std::chrono::duration<double> avg = s.average();
+    os << "  " << s.name << ": " << avg.count() << std::endl;
+  }
+  return os;
+}
+
+}
@@ -10,6 +10,7 @@
 #include <opencv2/core/mat.hpp>
 
 #include "acier/compressed_member.hpp"
+#include "acier/type_traits.hpp"
 #include "gil/vec.hpp"
 
 namespace gil {
@@ -49,7 +50,7 @@ class mat_view {
         stride_(stride),
         data_(data) {}
   mat_view(const mat_view& that) = default;
-  template <class U>
+  template <class U, acier::when<std::is_convertible<U*, T*>::value> = true>
   mat_view(const mat_view<U>& that)
       : rows_(that.rows()),
         cols_(that.cols()),
@@ -1,9 +1,12 @@
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
-
-#include <boost/filesystem.hpp>
-#include <boost/iostreams/device/mapped_file.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <opencv2/highgui/highgui.hpp>
 
@@ -11,24 +14,17 @@
 #include "gil/vec.hpp"
 #include "poisson_serial.hpp"
 #include "poisson_tbb.hpp"
+#include "poisson_cl.hpp"
+#include "poisson_cl_bands.hpp"
+#include "poisson_hybrid.hpp"
 
 #include "cl/device.hpp"
-#include "cl/context.hpp"
-#include "cl/memory.hpp"
-#include "cl/program.hpp"
-#include "cl/kernel.hpp"
-
-const size_t kNIter = 10000;
 
-/**
- * Finds the full path of |filename| in the working directory.
- */
-boost::filesystem::path find_file(const std::string& filename) {
-  boost::filesystem::path path(__FILE__);
-  path.remove_filename();
-  path.append(filename);
-  return path;
-}
+const size_t kSorNIter = kNIter / 10; // SOR converges in far fewer iterations
+const size_t kMgNCycles = 10; // V-cycles of the multigrid solver
+const size_t kCgNIter = kNIter / 10; // max iterations of conjugate gradient
+const size_t kStreamLength = 8; // frames of the pipelined benchmark
+const size_t kNSubDevices = 2; // bands of a CPU device split by device fission
 
 /**
  * Finds the smallest possible rectangular frame that contains the |mask|'s
@@ -91,11 +87,10 @@ void poisson_blending_serial(gil::mat_cview<uint8_t> mask,
   // and v_pq is the vector guidance field's value for the point between p and q,
   // ie. v_pq = g_p - g_q, with g_{something} being the source image's value at "something"
   // Do note that we do not reuse this notation.
-  gil::mat<gil::vec3f> b = make_guidance(dst, src, mask, method);
-  apply_mask(mask, b); // select the part corresponding to the mask's region
+  gil::mat<gil::vec3f> b(dst.size()); // right side of the equation, masked
   gil::mat<gil::vec3f> f(dst.size()); //Will contain the intensity of the image used as input to get f_p
   gil::mat<gil::vec3f> g(dst.size()); //Will contain the output of one iteration
-  copy(dst, mask, f); //applies the mask on destination and put the output as a copy in f.
+  prepare(dst, src, mask, method, b, f); // b, and the masked destination in f, in one pass
   for (int i = 0; i < kNIter; ++i) { // applying iterative method to have the value of f converge
     jacobi_iteration(f, b, mask, g); // Calculate the new value of g
     f.swap(g); // use g as an input for next iteration
@@ -130,12 +125,12 @@ void poisson_blending_tbb(gil::mat_cview<uint8_t> mask,
   // ie. v_pq = g_p - g_q, with g_{something} being the source image's value at "something"
   // Do note that we do not reuse this notation.
 
-  // calculate the right side of the equation, see above. Constant across solving
-  gil::mat<gil::vec3f> b = tbb_make_guidance(dst, src, mask, method);
-  tbb_apply_mask(mask, b); // select the part corresponding to the mask's region
+  // calculate the right side of the equation, see above, and the masked
+  // destination in f, in one pass. Constant across solving
+  gil::mat<gil::vec3f> b(dst.size());
   gil::mat<gil::vec3f> f(dst.size()); //Will contain the intensity of the image used as input to get f_p
   gil::mat<gil::vec3f> g(dst.size()); //Will contain the output of one iteration
-  copy(dst, mask, f); //applies the mask on destination and put the output as a copy in f.
+  tbb_prepare(dst, src, mask, method, b, f);
   for (int i = 0; i < kNIter; ++i) { // applying iterative method to have the value of f converge
     tbb_jacobi_iteration(f, b, mask, g); // Calculate the new value of g
     f.swap(g); // use g as an input for next iteration
@@ -145,168 +140,134 @@ void poisson_blending_tbb(gil::mat_cview<uint8_t> mask,
   // output |result| variable to return
 }
 
-// Class to be used to execute the poisson blending with OpenCL.
-// In a class to compile the OpenCL program on c++ compilation
-class poisson_blending_cl {
- public:
-  // Constructor, builds the OpenCL program
-  poisson_blending_cl()
-      : device_(cl::get_devices(cl::filter::gpu())[0]),
-        ctx_(device_) {
-    // read and load the OpenCL program from its file
-    boost::iostreams::mapped_file_source poisson_source(find_file("poisson.cl"));
-    program_ = cl::program(ctx_, poisson_source.data());
-    try {
-      program_.build();
-    } catch (...) {
-      std::cout << program_.get_build_info<cl::program::BuildLog>(device_);
-      return;
-    }
+/**
+ * Same as poisson_blending_serial, with the per-pixel boundary conditions
+ * |codes| instead of a mask, see make_boundary_codes.
+ */
+void poisson_blending_serial_codes(gil::mat_cview<uint8_t> codes,
+                                   gil::mat_cview<gil::vec3f> src,
+                                   gil::mat_cview<gil::vec3f> dst,
+                                   gil::mat_view<gil::vec3f> result,
+                                   GradientMethod method) {
+
+  assert(src.size() == codes.size());
+  assert(dst.size() == codes.size());
+
+  gil::mat<gil::vec3f> b(dst.size());
+  gil::mat<gil::vec3f> f(dst.size());
+  gil::mat<gil::vec3f> g(dst.size());
+  prepare_codes(dst, src, codes, method, b, f);
+  for (int i = 0; i < kNIter; ++i) {
+    jacobi_iteration_codes(f, b, codes, g);
+    f.swap(g);
+  }
+  result = f; // Dirichlet pixels hold the destination
+}
 
-    make_boundary_ = cl::kernel(program_, "make_boundary");
-    make_guidance_ = cl::kernel(program_, "make_guidance");
-    make_guidance_mixed_gradient_ = cl::kernel(program_, "make_guidance_mixed_gradient");
-    make_guidance_mixed_gradient_avg_ = cl::kernel(program_, "make_guidance_mixed_gradient_avg");
-    jacobi_iteration_ = cl::kernel(program_, "jacobi_iteration");
-    apply_mask_ = cl::kernel(program_, "apply_mask");
+/**
+ * Same as poisson_blending_tbb, with the per-pixel boundary conditions
+ * |codes| instead of a mask, see make_boundary_codes.
+ */
+void poisson_blending_tbb_codes(gil::mat_cview<uint8_t> codes,
+                                gil::mat_cview<gil::vec3f> src,
+                                gil::mat_cview<gil::vec3f> dst,
+                                gil::mat_view<gil::vec3f> result,
+                                GradientMethod method) {
+
+  assert(src.size() == codes.size());
+  assert(dst.size() == codes.size());
+
+  gil::mat<gil::vec3f> b(dst.size());
+  gil::mat<gil::vec3f> f(dst.size());
+  gil::mat<gil::vec3f> g(dst.size());
+  tbb_prepare_codes(dst, src, codes, method, b, f);
+  for (int i = 0; i < kNIter; ++i) {
+    tbb_jacobi_iteration_codes(f, b, codes, g);
+    f.swap(g);
   }
+  result = f; // Dirichlet pixels hold the destination
+}
 
-  /**
-   * Operator calculating the poisson blending using the OpenCL program.
-   * Finds a patch by applying |mask| upon |src| and blend this patch on |dst| at
-   * the corresponding region (again described by applying |mask|). The result
-   * of the blending is put in the output parameter |result|.
-   */
-  void operator()(gil::mat_cview<uint8_t> mask,
-                         gil::mat_cview<gil::vec3f> src,
-                         gil::mat_cview<gil::vec3f> dst,
-                         gil::mat_view<gil::vec3f> result,
-                         GradientMethod method) {
-
-    // Formula applied here : for all p in the destination domain (omega)
-    // |N_p| * f_p - sum[all q in (N_p intersection omega)]{f_q} =
-    // sum[all q in (N_p intersection delta_omega)]{f*_q} + sum[all q in N_p]{v_pq}
-    // (equation 7 of http://www.cs.virginia.edu/~connelly/class/2014/comp_photo/proj2/poisson.pdf)
-    // Where N_p are the neighbooring 4 pixels to p, f_p is the intensity of the source at p,
-    // delta_omega is the boundary's domain, f*_q the intensity of the destination at q
-    // and v_pq is the vector guidance field's value for the point between p and q,
-    // ie. v_pq = g_p - g_q, with g_{something} being the source image's value at "something"
-    // Do note that we do not reuse this notation.
-
-    // OpenCl image of the mask
-    cl::image cl_mask(ctx_,
-      cl::image_format{cl::channel_order::kR, cl::channel_type::kUInt8},
-      cl::image_desc::make_image_2d(mask.cols(), mask.rows()),
-      cl::buffer::device);
-
-    // OpenCl image of the boundary, used to calculate the right side of the poisson equation
-    cl::image cl_boundary(ctx_,
-      cl::image_format{cl::channel_order::kR, cl::channel_type::kUInt8},
-      cl::image_desc::make_image_2d(mask.cols(), mask.rows()),
-      cl::buffer::device);
-
-    // OpenCl image to contain the intensity values from last iteration
-    cl::image cl_f(ctx_,
-      cl::image_format{cl::channel_order::kRGB, cl::channel_type::kFloat},
-      cl::image_desc::make_image_2d(mask.cols(), mask.rows()),
-      cl::buffer::device);
-
-    // OpenCl image to contain the result of poisson iterations
-    cl::image cl_g(ctx_,
-      cl::image_format{cl::channel_order::kRGB, cl::channel_type::kFloat},
-      cl::image_desc::make_image_2d(mask.cols(), mask.rows()),
-      cl::buffer::device);
-
-    // OpenCl image to contain the right side of the equation
-    cl::image cl_guidance(ctx_,
-      cl::image_format{cl::channel_order::kRGB, cl::channel_type::kFloat},
-      cl::image_desc::make_image_2d(mask.cols(), mask.rows()),
-      cl::buffer::device);
-
-    // Initialise cl_mask using the mask image data
-    cl::write_image(cl_mask,
-      {0, 0, 0}, {mask.cols(), mask.rows(), 1}, mask.pitch(),
-      reinterpret_cast<const uint8_t*>(mask.data()))
-      (ctx_.default_queue(), {}).wait();
-
-    // Initialise cl_f using the destination image data
-    cl::write_image(cl_f,
-      {0, 0, 0}, {dst.cols(), dst.rows(), 1}, dst.pitch(),
-      reinterpret_cast<const uint8_t*>(dst.data()))
-      (ctx_.default_queue(), {}).wait();
-
-    // Initialise cl_g using the source image data
-    cl::write_image(cl_g,
-      {0, 0, 0}, {src.cols(), src.rows(), 1}, src.pitch(),
-      reinterpret_cast<const uint8_t*>(src.data()))
-      (ctx_.default_queue(), {}).wait();
-
-    // Initialise cl_boundary by calculating the cl_mask's boundary
-    cl::invoke_kernel(make_boundary_,
-      {mask.cols(), mask.rows()}, std::make_tuple(cl_mask, cl_boundary))
-      (ctx_.default_queue(), {}).wait();
-
-    // Initialise cl_guidance by calculating the right side of the poisson equation.
-    // We save the event of that call's end in e1.
-    cl::kernel b;
-    switch (method) {
-      default:
-      case GradientMethod::BASE:
-        b = make_guidance_;
-        break;
-
-      case GradientMethod::MAX_MIXING:
-        b = make_guidance_mixed_gradient_;
-        break;
-
-      case GradientMethod::AVG_MIXING:
-        b = make_guidance_mixed_gradient_avg_;
-        break;
-    }
-    auto e1 = cl::invoke_kernel(b,
-      {mask.cols(), mask.rows()},
-      std::make_tuple(cl_f, cl_g, cl_mask, cl_boundary, cl_guidance))
-      (ctx_.default_queue(), {});
-
-    // We apply the cl_mask on cl_f in order to select only the relevant information
-    // from the destination
-    cl::invoke_kernel(apply_mask_,
-      {mask.cols(), mask.rows()}, std::make_tuple(cl_mask, cl_f))
-      (ctx_.default_queue(), {}).wait();
-
-    // Using iterative method to calculate cl_g
-    for (size_t i = 0; i < kNIter; ++i) {
-      // Once e1 happened (guidance field complete for first iteration,
-      // previous iteration for the 499 other iterations), calculate
-      // a new value of intensity field based on the left side of the equation
-      e1 = cl::invoke_kernel(jacobi_iteration_,
-      {mask.cols(), mask.rows()},
-      std::make_tuple(cl_f, cl_guidance, cl_mask, cl_g))
-      (ctx_.default_queue(), {e1});
-      cl_g.swap(cl_f);
-    }
+/**
+ * Selects the OpenCL device described by |spec|: "gpu", "cpu" or
+ * "accelerator" for the first device of that type, a number for the device of
+ * that index, or else part of a device name. Falls back to the first CPU
+ * device when none matches.
+ */
+cl::device select_device(const std::string& spec) {
+  std::vector<cl::device> devices;
+  if (spec == "gpu") {
+    devices = cl::get_devices(cl::filter::gpu(), cl::filter::one());
+  } else if (spec == "cpu") {
+    devices = cl::get_devices(cl::filter::cpu(), cl::filter::one());
+  } else if (spec == "accelerator") {
+    devices = cl::get_devices(cl::filter::accelerator(), cl::filter::one());
+  } else if (!spec.empty() && std::all_of(spec.begin(), spec.end(), ::isdigit)) {
+    devices = cl::get_devices(cl::filter::nth(std::stoul(spec)));
+  } else {
+    devices = cl::get_devices(cl::filter::name(spec), cl::filter::one());
+  }
+  if (devices.empty()) {
+    devices = cl::get_devices(cl::filter::cpu(), cl::filter::one());
+  }
+  if (devices.empty()) {
+    throw std::runtime_error("no OpenCL device available");
+  }
+  return devices.front();
+}
 
-    result = dst;
-    gil::mat<gil::vec3f> tmp(dst.size());
-    // once the last iteration is done, copy the resulting cl_f into tmp matrix.
-    cl::read_image(cl_f,
-      {0, 0, 0}, {tmp.cols(), tmp.rows(), 1}, tmp.pitch(),
-      reinterpret_cast<uint8_t*>(tmp.data()))(ctx_.default_queue(), {e1}).wait();
-    copy(tmp, mask, result); // Apply mask on tmp and paste the output at the corresponding
-                             // region onto result, initialised with destination
+/**
+ * Selects the devices to split the frame over: every GPU if there are
+ * several, else |device| split into kNSubDevices sub-devices if it is a CPU
+ * with enough compute units, else |device| alone.
+ */
+std::vector<cl::device> select_band_devices(cl::device device) {
+  std::vector<cl::device> gpus = cl::get_devices(cl::filter::gpu());
+  if (gpus.size() > 1) {
+    return gpus;
+  }
+  if (device.type() == CL_DEVICE_TYPE_CPU &&
+      device.max_compute_units() >= kNSubDevices) {
+    return cl::create_sub_devices(device, kNSubDevices);
   }
+  return {device};
+}
 
- private:
-  cl::device device_;
-  cl::context ctx_;
-  cl::program program_;
-  cl::kernel make_boundary_;
-  cl::kernel make_guidance_;
-  cl::kernel make_guidance_mixed_gradient_;
-  cl::kernel make_guidance_mixed_gradient_avg_;
-  cl::kernel jacobi_iteration_;
-  cl::kernel apply_mask_;
-};
+/**
+ * Prints how much the 8-bit results |a| and |b| of blending with |mask|
+ * differ: the largest difference of a channel, and over the pixels of the
+ * mask, the only ones blending changes, the average one and the share of
+ * pixels that differ at all.
+ */
+void print_difference(gil::mat_cview<gil::vec3b> a, gil::mat_cview<gil::vec3b> b,
+                      gil::mat_cview<uint8_t> mask) {
+  assert(a.size() == b.size());
+  assert(mask.size() == a.size());
+  int max_diff = 0;
+  double sum_diff = 0;
+  size_t n_diff = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < a.rows(); ++i) {
+    const gil::vec3b* a_it = a.row_begin(i);
+    const gil::vec3b* b_it = b.row_begin(i);
+    const uint8_t* mask_it = mask.row_begin(i);
+    for (size_t j = 0; j < a.cols(); ++j, ++a_it, ++b_it, ++mask_it) {
+      n += *mask_it >= 128;
+      bool differs = false;
+      for (size_t c = 0; c < 3; ++c) {
+        int diff = std::abs(int((*a_it)[c]) - int((*b_it)[c]));
+        max_diff = std::max(max_diff, diff);
+        sum_diff += diff;
+        differs |= diff != 0;
+      }
+      n_diff += differs;
+    }
+  }
+  n = std::max(n, size_t(1));
+  std::cout << "  max difference: " << max_diff << std::endl
+            << "  mean difference: " << sum_diff / (3 * n) << std::endl
+            << "  pixels differing: " << 100.0 * n_diff / n << "%" << std::endl;
+}
 
 template <class F>
 double benchmark(const F& fcn, int nb_run = 3) {
@@ -330,11 +291,11 @@ std::string make_filename(const std::string& base, GradientMethod method) {
 int main(int argc, const char *argv[]) {
   using namespace std::placeholders;
 
-  // Load images
-  gil::mat<gil::vec3f> dst(gil::mat_view<gil::vec3b>(
-      cv::imread(argv[1])));
-  gil::mat<gil::vec3f> src(gil::mat_view<gil::vec3b>(
-      cv::imread(argv[2])));
+  // Load images, keeping the 8-bit frames for the path that uploads them as is
+  cv::Mat dst_bgr = cv::imread(argv[1]);
+  cv::Mat src_bgr = cv::imread(argv[2]);
+  gil::mat<gil::vec3f> dst{gil::mat_view<gil::vec3b>(dst_bgr)};
+  gil::mat<gil::vec3f> src{gil::mat_view<gil::vec3b>(src_bgr)};
   gil::mat<uint8_t> mask(gil::mat_view<gil::vec3b>(cv::imread(argv[3])));
   GradientMethod method = static_cast<GradientMethod>(atoi(argv[4]));
   
@@ -347,18 +308,128 @@ int main(int argc, const char *argv[]) {
   }) << std::endl;
   cv::imwrite(make_filename("result-serial", method), cv::Mat(result));
 
-  // Time the opencl calculation of serial poisson blending and save its output in a file
-  poisson_blending_cl poisson_blending_cl;
+  // Time the opencl calculation of serial poisson blending and save its output in a file,
+  // followed by the device time of each of its stages
+  cl::device device = select_device(argc > 5 ? argv[5] : "gpu");
+  std::cout << device << std::endl;
+  poisson_blending_cl poisson_blending_cl(device, true);
   std::cout << benchmark([&](){
     poisson_blending_cl(mask[frame], src[frame], dst[frame], result[frame], method);
   }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
   cv::imwrite(make_filename("result-cl", method), cv::Mat(result));
 
+  // Same, uploading the 8-bit frames and converting them on the device
+  gil::mat_view<gil::vec3b> dst8(dst_bgr);
+  gil::mat_view<gil::vec3b> src8(src_bgr);
+  gil::mat<gil::vec3b> result8(dst8);
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    poisson_blending_cl(mask[frame], src8[frame], dst8[frame], result8[frame], method);
+  }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
+  cv::imwrite(make_filename("result-cl-u8", method), cv::Mat(result8));
+
+  // Same, storing the images as half floats, and how much that changes the
+  // 8-bit output
+  if (poisson_blending_cl.set_storage(cl::channel_type::kHalfFloat)) {
+    gil::mat<gil::vec3b> result8_half(dst8);
+    poisson_blending_cl.clear_profile();
+    std::cout << benchmark([&](){
+      poisson_blending_cl(mask[frame], src8[frame], dst8[frame], result8_half[frame], method);
+    }) << std::endl;
+    std::cout << poisson_blending_cl.profile();
+    print_difference(result8, result8_half, mask);
+    cv::imwrite(make_filename("result-cl-u8-half", method), cv::Mat(result8_half));
+    bool restored = poisson_blending_cl.set_storage(cl::channel_type::kFloat);
+    assert(restored);
+    (void)restored;
+  }
+
+  // Same, as a stream of jobs pipelined on the device: the time per frame
+  std::vector<gil::mat<gil::vec3b>> stream(kStreamLength, result8);
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    for (auto& frame_result : stream) {
+      poisson_blending_cl.submit(mask[frame], src8[frame], dst8[frame], frame_result[frame], method);
+    }
+    poisson_blending_cl.finish();
+  }) / kStreamLength << std::endl;
+  std::cout << poisson_blending_cl.profile();
+
+  // Same as the first opencl run, split in bands over several devices
+  std::vector<cl::device> band_devices = select_band_devices(device);
+  poisson_blending_cl_bands poisson_blending_cl_bands(band_devices);
+  std::cout << band_devices.size() << " bands" << std::endl;
+  std::cout << benchmark([&](){
+    poisson_blending_cl_bands(mask[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  cv::imwrite(make_filename("result-cl-bands", method), cv::Mat(result));
+
+  // Same as the first opencl run, sharing the frame with the host, run twice
+  // more than the others to rebalance the split
+  poisson_blending_hybrid poisson_blending_hybrid(device);
+  std::cout << benchmark([&](){
+    poisson_blending_hybrid(mask[frame], src[frame], dst[frame], result[frame], method);
+  }, 5) << std::endl;
+  std::cout << "  host share: " << poisson_blending_hybrid.host_share() << std::endl;
+  cv::imwrite(make_filename("result-hybrid", method), cv::Mat(result));
+
+  // Same as the first opencl run, with red-black SOR instead of Jacobi
+  poisson_blending_cl.set_solver(SolverMethod::SOR, kSorNIter);
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    poisson_blending_cl(mask[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
+  cv::imwrite(make_filename("result-cl-sor", method), cv::Mat(result));
+
+  // Same, with multigrid V-cycles
+  poisson_blending_cl.set_solver(SolverMethod::MULTIGRID, kMgNCycles);
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    poisson_blending_cl(mask[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
+  cv::imwrite(make_filename("result-cl-mg", method), cv::Mat(result));
+
+  // Same, with preconditioned conjugate gradient
+  poisson_blending_cl.set_solver(SolverMethod::CG, kCgNIter);
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    poisson_blending_cl(mask[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
+  cv::imwrite(make_filename("result-cl-cg", method), cv::Mat(result));
+
   // Time the tbb calculation of serial poisson blending and save its output in a file
   std::cout << benchmark([&](){
     poisson_blending_tbb(mask[frame], src[frame], dst[frame], result[frame], method);
   }) << std::endl;
   cv::imwrite(make_filename("result-tbb", method), cv::Mat(result));
 
+  // Same with boundary codes, as in seamless blending: the mask's pixels on
+  // the image border get a zero derivative instead of keeping the
+  // destination. The codes are made over the whole images, so that the frame
+  // keeps them, then solved over the frame with kNIter Jacobi iterations, as
+  // the serial, tbb and first opencl runs. Serial, tbb then opencl.
+  gil::mat<uint8_t> codes = make_boundary_codes(mask);
+  std::cout << benchmark([&](){
+    poisson_blending_serial_codes(codes[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  cv::imwrite(make_filename("result-serial-codes", method), cv::Mat(result));
+
+  std::cout << benchmark([&](){
+    poisson_blending_tbb_codes(codes[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  cv::imwrite(make_filename("result-tbb-codes", method), cv::Mat(result));
+
+  poisson_blending_cl.clear_profile();
+  std::cout << benchmark([&](){
+    poisson_blending_cl.blend_codes(codes[frame], src[frame], dst[frame], result[frame], method);
+  }) << std::endl;
+  std::cout << poisson_blending_cl.profile();
+  cv::imwrite(make_filename("result-cl-codes", method), cv::Mat(result));
+
   return 0;
 }
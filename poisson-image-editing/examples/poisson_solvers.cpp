@@ -0,0 +1,87 @@
+/**
+ This file is part of Poisson Image Editing.
+ 
+ Copyright Christoph Heindl 2015
+ 
+ Poisson Image Editing is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ Poisson Image Editing is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with Poisson Image Editing.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <blend/poisson_solver.h>
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <iostream>
+
+template <class F>
+double benchmark(const F& fcn, int nb_run = 3) {
+  double avg = 0;
+  for (int i = 0; i < nb_run; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fcn();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    avg += diff.count();
+  }
+  avg /= nb_run;
+  return avg;
+}
+
+/**
+ 
+ Compares the sparse solvers on square domains of increasing size, with Dirichlet 
+ boundary values on the domain border.
+ 
+ */
+int main(int argc, char **argv)
+{
+    const blend::SolverType types[] = {
+        blend::SOLVER_SPARSE_LU,
+        blend::SOLVER_SIMPLICIAL_LDLT,
+        blend::SOLVER_SIMPLICIAL_LLT,
+        blend::SOLVER_CONJUGATE_GRADIENT,
+        blend::SOLVER_MATRIX_FREE
+    };
+    const char *names[] = { "lu", "ldlt", "llt", "cg", "matrix-free" };
+    const int ntypes = sizeof(types) / sizeof(types[0]);
+    
+    std::cout << "size";
+    for (int t = 0; t < ntypes; ++t)
+        std::cout << "\t" << names[t];
+    std::cout << std::endl;
+    
+    for (int size = 64; size <= 1024; size *= 2) {
+        cv::Mat f(size, size, CV_32FC3);
+        f.setTo(0);
+        
+        cv::Mat bmask(size, size, CV_8UC1);
+        bmask.setTo(blend::constants::UNKNOWN);
+        cv::rectangle(bmask, cv::Rect(0, 0, size, size), blend::constants::DIRICHLET_BD, 1);
+        
+        cv::Mat bvalues(size, size, CV_32FC3);
+        bvalues.setTo(0);
+        bvalues.col(0).setTo(cv::Scalar(255, 128, 0));
+        
+        std::cout << size;
+        for (int t = 0; t < ntypes; ++t) {
+            cv::Mat result;
+            std::cout << "\t" << benchmark([&](){
+                blend::solvePoissonEquations(f, bmask, bvalues, result, types[t]);
+            });
+        }
+        std::cout << std::endl;
+    }
+    
+    return 0;
+}
@@ -21,6 +21,7 @@
 #define POISSON_BLEND_H
 
 #include <opencv2/core/core.hpp>
+#include <blend/poisson_solver.h>
 
 namespace blend {
     
@@ -31,11 +32,33 @@ namespace blend {
      Sadeghi, Mohammad Amin, Seyyed Mohammad Mohsen Hejrati, and Niloofar Gheissari. 
      "Poisson Local Color Correction for Image Stitching." VISAPP (1). 2008.
      
+     The correction field is solved with the given solver. For large images SOLVER_MATRIX_FREE 
+     avoids assembling the sparse system.
+     
      */
     void seamlessBlend(cv::InputArray first,
                        cv::InputArray second,
                        cv::InputArray mask,
-                       cv::OutputArray destination);
+                       cv::OutputArray destination,
+                       SolverType solver = SOLVER_SPARSE_LU);
+    
+    /**
+     
+     Seamless image blending, solving exactly only near the seam.
+     
+     The correction field of seamlessBlend is harmonic and smooth away from the seam. This variant solves 
+     it exactly within bandWidth pixels of the mask boundary only. Farther pixels take the solution of the 
+     same problem at half resolution, upsampled, which also serves as boundary condition of the band. The
+     half resolution problem is solved the same way down to small images, so that the work grows about 
+     linearly with the image. Results usually stay within a few intensity levels of seamlessBlend.
+     
+     */
+    void seamlessBlendBand(cv::InputArray first,
+                           cv::InputArray second,
+                           cv::InputArray mask,
+                           cv::OutputArray destination,
+                           int bandWidth,
+                           SolverType solver = SOLVER_SPARSE_LU);
 
 }
 #endif
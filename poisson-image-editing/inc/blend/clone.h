@@ -21,6 +21,8 @@
 #define POISSON_CLONE_H
 
 #include <opencv2/core/core.hpp>
+#include <blend/poisson_solver.h>
+#include <vector>
 
 namespace blend {
     
@@ -40,6 +42,21 @@ namespace blend {
                          cv::Rect &rBackground,
                          cv::Rect &rForeground);
         
+        /**
+         
+         Determine the area to solve for when cloning.
+         
+         Restricts the area of overlap to the bounding box of the foreground mask, grown by one pixel. 
+         Returns false when no mask pixel falls inside the overlap.
+         
+         */
+        bool findCloneRegion(cv::InputArray background,
+                             cv::InputArray foreground,
+                             cv::InputArray foregroundMask,
+                             int offsetX, int offsetY,
+                             cv::Rect &rBackground,
+                             cv::Rect &rForeground);
+        
         /** 
          
          Compute Poisson guidance vector field by mixing gradients from background and foreground.
@@ -85,6 +102,22 @@ namespace blend {
         CLONE_MIXED_GRADIENTS
     };
     
+    namespace detail {
+        
+        /**
+         
+         Compute the divergence of the Poisson guidance vector field of the given clone type in a single pass.
+         
+         Equivalent to computing the guidance vector field followed by its central difference divergence, 
+         without the intermediate gradient images.
+         
+         */
+        void computeGuidanceFieldDivergence(cv::InputArray background,
+                                            cv::InputArray foreground,
+                                            cv::OutputArray divergence,
+                                            CloneType type);
+    }
+    
     /**
      
      Seamless image cloning.
@@ -103,6 +136,8 @@ namespace blend {
      
      Depending on the vector guidance field differents blend effects can be generated.
      
+     The Poisson equation is solved with the given solver, see SolverType.
+     
      */
     void seamlessClone(cv::InputArray background,
                        cv::InputArray foreground,
@@ -110,7 +145,26 @@ namespace blend {
                        int offsetX,
                        int offsetY,
                        cv::OutputArray destination,
-                       CloneType type);
+                       CloneType type,
+                       SolverType solver = SOLVER_SPARSE_LU);
+    
+    /**
+     
+     Seamless cloning of several foregrounds through the same mask.
+     
+     Clones each foreground onto background as seamlessClone does, using one mask and offset for all
+     foregrounds, which must share their size. The Poisson system only depends on the mask, so it is 
+     factorized once and the right hand sides of all foregrounds are back-substituted together.
+     
+     */
+    void seamlessCloneBatch(cv::InputArray background,
+                            const std::vector<cv::Mat> &foregrounds,
+                            cv::InputArray foregroundMask,
+                            int offsetX,
+                            int offsetY,
+                            std::vector<cv::Mat> &destinations,
+                            CloneType type,
+                            SolverType solver = SOLVER_SPARSE_LU);
 
 }
 #endif
\ No newline at end of file
@@ -21,6 +21,7 @@
 #define POISSON_SOLVER_H
 
 #include <opencv2/core/core.hpp>
+#include <memory>
 
 namespace blend {
 
@@ -29,6 +30,36 @@ namespace blend {
         const unsigned char DIRICHLET_BD = 1;
         const unsigned char NEUMANN_BD = 2;
     }
+
+    /**
+     
+     Defines the available sparse solvers.
+     
+     The coefficient matrix is symmetric unless Neumann boundary conditions are present, in which 
+     case the symmetric solvers fall back to SOLVER_SPARSE_LU. The same fallback applies when the 
+     factorization fails, e.g. for domains without any Dirichlet boundary condition, and when 
+     conjugate gradient does not converge.
+     
+     */
+    enum SolverType {
+        /** General sparse LU factorization. */
+        SOLVER_SPARSE_LU,
+        /** Sparse Cholesky LDL^T factorization of the negated, positive definite, system. */
+        SOLVER_SIMPLICIAL_LDLT,
+        /** Sparse Cholesky LL^T factorization of the negated, positive definite, system. */
+        SOLVER_SIMPLICIAL_LLT,
+        /** Conjugate gradient preconditioned by incomplete Cholesky. Needs little memory on large domains. */
+        SOLVER_CONJUGATE_GRADIENT,
+        /** 
+            Krylov solver applying the stencil directly on the boundary mask, without assembling a matrix. 
+            Uses conjugate gradient, or BiCGSTAB when Neumann boundary conditions are present, both with a 
+            Jacobi preconditioner. Needs a few image sized vectors only, which suits very large domains. The 
+            iteration count grows with the extent of the domain and is capped at 10 * (rows + cols) + 100. 
+            Without convergence, e.g. when BiCGSTAB breaks down or stalls in single precision, the system 
+            is solved by SOLVER_SPARSE_LU.
+        */
+        SOLVER_MATRIX_FREE
+    };
      
     /**        
         Solve multi-channel Poisson equations on rectangular domain.
@@ -37,7 +68,49 @@ namespace blend {
         cv::InputArray f,
         cv::InputArray bdMask,
         cv::InputArray bdValues,
-        cv::OutputArray result);
+        cv::OutputArray result,
+        SolverType type = SOLVER_SPARSE_LU);
+
+    /**
+        Poisson solver reusing its factorization across calls.
+     
+        The coefficient matrix only depends on the boundary mask. The solver keeps the factorized
+        matrix and the pixel to unknown lookup, keyed by a hash and a copy of the mask, so that solving
+        again with the same mask only assembles the right hand side and back-substitutes.
+    */
+    class PoissonSolver {
+    public:
+        PoissonSolver(SolverType type = SOLVER_SPARSE_LU);
+        ~PoissonSolver();
+
+        /**
+            Solve multi-channel Poisson equations on rectangular domain. Same as solvePoissonEquations.
+        */
+        void solve(
+            cv::InputArray f,
+            cv::InputArray bdMask,
+            cv::InputArray bdValues,
+            cv::OutputArray result);
+
+        /** Drop the cached factorization. */
+        void clear();
+
+        /** Solver used for the cached factorization, after fallback. */
+        SolverType activeSolverType() const;
+
+        /** Number of factorizations built so far, which solves reusing the cached one leave unchanged. */
+        int factorizationCount() const;
+
+    private:
+        PoissonSolver(const PoissonSolver &);
+        PoissonSolver &operator=(const PoissonSolver &);
+
+        SolverType _type;
+        int _nFactorizations;
+
+        struct Factorization;
+        std::unique_ptr<Factorization> _factorization;
+    };
 
 }
 #endif
\ No newline at end of file
@@ -31,31 +31,22 @@ namespace blend {
         return Eigen::Map<V>(m.ptr<T>(y, x), m.channels());
     }
     
-    void seamlessBlend(cv::InputArray first_,
-                       cv::InputArray second_,
-                       cv::InputArray mask_,
-                       cv::OutputArray destination_)
+    /* Boundary conditions of the correction field added to first, see seamlessBlend. */
+    void buildBoundaryConditions(cv::Mat first,
+                                 cv::Mat second,
+                                 cv::Mat mask,
+                                 cv::Mat &bm,
+                                 cv::Mat &bv)
     {
-        
-        cv::Mat first = first_.getMat();
-        cv::Mat second = second_.getMat();
-        
-        destination_.create(first.size(), first.type());
-        cv::Mat dst = destination_.getMat();
-        
-        // Target Laplacians are zero
-        cv::Mat f(first.size(), CV_MAKE_TYPE(CV_32F, first.channels()));
-        f.setTo(0);
-        
-        cv::Mat bm(first.size(), CV_8UC1);
+        bm.create(first.size(), CV_8UC1);
         bm.setTo(constants::UNKNOWN);
-        cv::Mat bv(first.size(), CV_MAKE_TYPE(CV_32F, first.channels()));
+        bv.create(first.size(), CV_MAKE_TYPE(CV_32F, first.channels()));
         bv.setTo(0);
         
         cv::Rect boundsSecond(0, 0, second.cols, second.rows);
         
         for (int y = 0; y < first.rows; ++y) {
-            const uchar *maskRow = mask_.getMat().ptr<uchar>(y);
+            const uchar *maskRow = mask.ptr<uchar>(y);
             for (int x = 0; x < first.cols; ++x) {
                 const bool isBorder = (y == 0) || (x == 0) || (y == (first.rows - 1)) || (x == (first.cols - 1));
                 const bool isFirst = (maskRow[x] == 255);
@@ -72,22 +63,123 @@ namespace blend {
                 }
             }
         }
+    }
+    
+    /* Add the correction field to first and copy second outside of the mask. */
+    void composeResult(const cv::Mat &first,
+                       const cv::Mat &second,
+                       const cv::Mat &mask,
+                       const cv::Mat &correction,
+                       cv::Mat &dst)
+    {
+        cv::Mat fixed;
+        first.convertTo(fixed, correction.depth());
+        fixed += correction;
+        fixed.convertTo(dst, dst.depth());
+        second.copyTo(dst, (255 - mask));
+    }
+    
+    void seamlessBlend(cv::InputArray first_,
+                       cv::InputArray second_,
+                       cv::InputArray mask_,
+                       cv::OutputArray destination_,
+                       SolverType solver)
+    {
+        
+        cv::Mat first = first_.getMat();
+        cv::Mat second = second_.getMat();
+        cv::Mat mask = mask_.getMat();
+        
+        destination_.create(first.size(), first.type());
+        cv::Mat dst = destination_.getMat();
         
+        // Target Laplacians are zero
+        cv::Mat f(first.size(), CV_MAKE_TYPE(CV_32F, first.channels()));
+        f.setTo(0);
+        
+        cv::Mat bm, bv;
+        buildBoundaryConditions(first, second, mask, bm, bv);
         
         // Solve Poisson equation
         cv::Mat result;
         solvePoissonEquations(f,
                               bm,
                               bv,
-                              result);
+                              result,
+                              solver);
         
-        cv::Mat fixed;
-        first.convertTo(fixed, result.depth());
-        fixed += result;
-        fixed.convertTo(dst, dst.depth());
-        second.copyTo(dst, (255 - mask_.getMat()));
+        composeResult(first, second, mask, result, dst);
+    }
+    
+    /* Number of pixels below which seamlessBlendBand solves the correction field exactly. */
+    const int bandExactSolvePixels = 128 * 128;
+    
+    /* 
+        Correction field of seamlessBlend, solved exactly within bandWidth pixels of the seam. The interior
+        is taken from the same computation at half resolution, recursively, and fixed as Dirichlet boundary.
+    */
+    void solveCorrectionInBand(cv::Mat first,
+                               cv::Mat second,
+                               cv::Mat mask,
+                               int bandWidth,
+                               SolverType solver,
+                               cv::Mat &correction)
+    {
+        // Target Laplacians are zero
+        cv::Mat f(first.size(), CV_MAKE_TYPE(CV_32F, first.channels()));
+        f.setTo(0);
+        
+        cv::Mat bm, bv;
+        buildBoundaryConditions(first, second, mask, bm, bv);
         
+        // Pixels of first farther than bandWidth from the seam. Image borders carry Neumann conditions
+        // and are no seam, pixels outside of the image do not erode the mask.
+        cv::Mat interior;
+        cv::erode(mask == 255, interior, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * bandWidth + 1, 2 * bandWidth + 1)));
+        
+        if (first.total() > static_cast<size_t>(bandExactSolvePixels) && cv::countNonZero(interior) > 0) {
+            const cv::Size coarseSize((first.cols + 1) / 2, (first.rows + 1) / 2);
+            
+            cv::Mat coarseFirst, coarseSecond, coarseMask;
+            cv::resize(first, coarseFirst, coarseSize, 0, 0, cv::INTER_AREA);
+            cv::resize(second, coarseSecond, coarseSize, 0, 0, cv::INTER_AREA);
+            cv::resize(mask, coarseMask, coarseSize, 0, 0, cv::INTER_NEAREST);
+            
+            cv::Mat coarseCorrection, upsampled;
+            solveCorrectionInBand(coarseFirst, coarseSecond, coarseMask, bandWidth, solver, coarseCorrection);
+            cv::resize(coarseCorrection, upsampled, first.size(), 0, 0, cv::INTER_LINEAR);
+            
+            bm.setTo(constants::DIRICHLET_BD, interior);
+            upsampled.copyTo(bv, interior);
+        }
+        
+        solvePoissonEquations(f,
+                              bm,
+                              bv,
+                              correction,
+                              solver);
+    }
+    
+    void seamlessBlendBand(cv::InputArray first_,
+                           cv::InputArray second_,
+                           cv::InputArray mask_,
+                           cv::OutputArray destination_,
+                           int bandWidth,
+                           SolverType solver)
+    {
+        CV_Assert(bandWidth > 0);
+        
+        cv::Mat first = first_.getMat();
+        cv::Mat second = second_.getMat();
+        cv::Mat mask = mask_.getMat();
+        
+        destination_.create(first.size(), first.type());
+        cv::Mat dst = destination_.getMat();
+        
+        cv::Mat result;
+        solveCorrectionInBand(first, second, mask, bandWidth, solver, result);
         
+        composeResult(first, second, mask, result, dst);
     }
     
     
@@ -81,7 +81,7 @@ namespace blend {
             cv::filter2D(bg, vyb, CV_32F, kernely, cv::Point(-1,-1), 0, cv::BORDER_REPLICATE);
             
             
-            for(int id = 0; id <= (vx.rows * vx.cols * channels - channels); ++id)
+            for(int id = 0; id < (vx.rows * vx.cols * channels); ++id)
             {
                 const cv::Vec2f g[2] = {
                     cv::Vec2f(vxf.ptr<float>()[id], vyf.ptr<float>()[id]),
@@ -117,6 +117,177 @@ namespace blend {
             cv::addWeighted(vxf, weightForeground, vxb, 1.f - weightForeground, 0, vx);
             cv::addWeighted(vyf, weightForeground, vyb, 1.f - weightForeground, 0, vy);
         }
+
+        /* 
+            Fused guidance field and divergence over a range of rows. Gradients are central differences 
+            with replicated borders, the divergence uses central differences with reflected borders, which 
+            makes it vanish on the image border. Mirrors the filter2D based computation, which also reads
+            pixels of the parent image around a region of interest.
+        */
+        template<class T>
+        class GuidanceFieldDivergence : public cv::ParallelLoopBody {
+        public:
+            GuidanceFieldDivergence(const cv::Mat &bg, const cv::Mat &fg, cv::Mat &div, CloneType type)
+                : _bg(bg), _fg(fg), _div(div), _type(type),
+                  _weight(type == CLONE_AVERAGED_GRADIENTS ? 0.5f : 1.f),
+                  _bgBounds(readableBounds(bg)), _fgBounds(readableBounds(fg))
+            {}
+            
+            void operator()(const cv::Range &rows) const {
+                const int cols = _div.cols;
+                const int channels = _div.channels();
+                
+                for (int y = rows.start; y < rows.end; ++y) {
+                    float *divRow = _div.ptr<float>(y);
+                    
+                    // Interior of linear guidance fields: the divergence of the gradient is a wide Laplacian.
+                    int xBegin = cols;
+                    int xEnd = cols;
+                    if (_type != CLONE_MIXED_GRADIENTS && y >= 2 && y < _div.rows - 2 && cols > 4) {
+                        xBegin = 2;
+                        xEnd = cols - 2;
+                        wideLaplacian(y, xBegin, xEnd, divRow);
+                    }
+                    
+                    for (int x = 0; x < cols; ++x) {
+                        if (x == xBegin) {
+                            x = xEnd - 1;
+                            continue;
+                        }
+                        for (int c = 0; c < channels; ++c) {
+                            divRow[x * channels + c] = divergence(y, x, c);
+                        }
+                    }
+                }
+            }
+            
+        private:
+            /* Area of the parent image, relative to the region of interest. */
+            static cv::Rect readableBounds(const cv::Mat &m) {
+                cv::Size whole;
+                cv::Point ofs;
+                m.locateROI(whole, ofs);
+                return cv::Rect(-ofs.x, -ofs.y, whole.width, whole.height);
+            }
+            
+            /* Element access which may reach outside the region of interest. */
+            float at(const cv::Mat &m, int y, int x, int c) const {
+                const uchar *row = m.data + y * static_cast<std::ptrdiff_t>(m.step);
+                return static_cast<float>(reinterpret_cast<const T*>(row)[x * m.channels() + c]);
+            }
+            
+            /* Gradient by central differences with replicated borders. */
+            cv::Vec2f gradient(const cv::Mat &m, const cv::Rect &bounds, int y, int x, int c) const {
+                const int xl = std::max(x - 1, bounds.x), xr = std::min(x + 1, bounds.x + bounds.width - 1);
+                const int yt = std::max(y - 1, bounds.y), yb = std::min(y + 1, bounds.y + bounds.height - 1);
+                return cv::Vec2f(0.5f * (at(m, y, xr, c) - at(m, y, xl, c)),
+                                 0.5f * (at(m, yb, x, c) - at(m, yt, x, c)));
+            }
+            
+            cv::Vec2f guidance(int y, int x, int c) const {
+                const cv::Vec2f gf = gradient(_fg, _fgBounds, y, x, c);
+                const cv::Vec2f gb = gradient(_bg, _bgBounds, y, x, c);
+                
+                if (_type == CLONE_MIXED_GRADIENTS) {
+                    return (gf.dot(gf) > gb.dot(gb)) ? gf : gb;
+                }
+                return cv::Vec2f(_weight * gf[0] + (1.f - _weight) * gb[0],
+                                 _weight * gf[1] + (1.f - _weight) * gb[1]);
+            }
+            
+            float divergence(int y, int x, int c) const {
+                float d = 0.f;
+                if (x > 0 && x < _div.cols - 1) {
+                    d += 0.5f * (guidance(y, x + 1, c)[0] - guidance(y, x - 1, c)[0]);
+                }
+                if (y > 0 && y < _div.rows - 1) {
+                    d += 0.5f * (guidance(y + 1, x, c)[1] - guidance(y - 1, x, c)[1]);
+                }
+                return d;
+            }
+            
+            void wideLaplacian(int y, int xBegin, int xEnd, float *divRow) const {
+                const int channels = _div.channels();
+                const int step = 2 * channels;
+                const float wf = 0.25f * _weight;
+                const float wb = 0.25f * (1.f - _weight);
+                
+                const T *f = _fg.ptr<T>(y), *ft = _fg.ptr<T>(y - 2), *fb = _fg.ptr<T>(y + 2);
+                const T *b = _bg.ptr<T>(y), *bt = _bg.ptr<T>(y - 2), *bb = _bg.ptr<T>(y + 2);
+                
+                for (int i = xBegin * channels; i < xEnd * channels; ++i) {
+                    const float lf = static_cast<float>(f[i - step]) + static_cast<float>(f[i + step]) +
+                                     static_cast<float>(ft[i]) + static_cast<float>(fb[i]) - 4.f * static_cast<float>(f[i]);
+                    const float lb = static_cast<float>(b[i - step]) + static_cast<float>(b[i + step]) +
+                                     static_cast<float>(bt[i]) + static_cast<float>(bb[i]) - 4.f * static_cast<float>(b[i]);
+                    divRow[i] = wf * lf + wb * lb;
+                }
+            }
+            
+            const cv::Mat &_bg;
+            const cv::Mat &_fg;
+            cv::Mat &_div;
+            CloneType _type;
+            float _weight;
+            cv::Rect _bgBounds;
+            cv::Rect _fgBounds;
+        };
+        
+        void computeGuidanceFieldDivergence(cv::InputArray background,
+                                            cv::InputArray foreground,
+                                            cv::OutputArray divergence,
+                                            CloneType type)
+        {
+            CV_Assert(
+                background.size() == foreground.size() &&
+                background.type() == foreground.type() &&
+                (type == CLONE_FOREGROUND_GRADIENTS || type == CLONE_AVERAGED_GRADIENTS || type == CLONE_MIXED_GRADIENTS));
+            
+            cv::Mat bg = background.getMat();
+            cv::Mat fg = foreground.getMat();
+            
+            divergence.create(bg.size(), CV_MAKETYPE(CV_32F, bg.channels()));
+            cv::Mat div = divergence.getMat();
+            
+            const cv::Range rows(0, bg.rows);
+            
+            if (bg.depth() == CV_8U) {
+                cv::parallel_for_(rows, GuidanceFieldDivergence<uchar>(bg, fg, div, type));
+            } else if (bg.depth() == CV_32F) {
+                cv::parallel_for_(rows, GuidanceFieldDivergence<float>(bg, fg, div, type));
+            } else {
+                cv::Mat bgf, fgf;
+                bg.convertTo(bgf, CV_32F);
+                fg.convertTo(fgf, CV_32F);
+                cv::parallel_for_(rows, GuidanceFieldDivergence<float>(bgf, fgf, div, type));
+            }
+        }
+        
+        bool findCloneRegion(cv::InputArray background,
+                             cv::InputArray foreground,
+                             cv::InputArray foregroundMask,
+                             int offsetX, int offsetY,
+                             cv::Rect &rBackground,
+                             cv::Rect &rForeground)
+        {
+            if (!findOverlap(background, foreground, offsetX, offsetY, rBackground, rForeground))
+                return false;
+            
+            // Shrink the region to the bounding box of the mask, grown by one pixel so that the box border 
+            // is a Dirichlet boundary. Gradients still see the pixels around the box, so the result equals
+            // solving over the whole overlap.
+            cv::Mat maskPixels;
+            cv::findNonZero(foregroundMask.getMat()(rForeground), maskPixels);
+            if (maskPixels.empty())
+                return false;
+            
+            cv::Rect box = cv::boundingRect(maskPixels);
+            box = cv::Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2) & cv::Rect(0, 0, rForeground.width, rForeground.height);
+            rBackground = cv::Rect(rBackground.x + box.x, rBackground.y + box.y, box.width, box.height);
+            rForeground = cv::Rect(rForeground.x + box.x, rForeground.y + box.y, box.width, box.height);
+            
+            return true;
+        }
     }
     
     void seamlessClone(cv::InputArray background,
@@ -125,53 +296,24 @@ namespace blend {
                        int offsetX,
                        int offsetY,
                        cv::OutputArray destination,
-                       CloneType type)
+                       CloneType type,
+                       SolverType solver)
     {
         
         // Copy original background as we only solve for the overlapping area of the translated foreground mask.
         background.getMat().copyTo(destination);
         
-        // Find overlapping region. We will only perform on this region
+        // Find the region to solve for.
         cv::Rect rbg, rfg;
-        if (!detail::findOverlap(background, foreground, offsetX, offsetY, rbg, rfg))
+        if (!detail::findCloneRegion(background, foreground, foregroundMask, offsetX, offsetY, rbg, rfg))
             return;
         
-        // Compute the guidance vector field
-        cv::Mat vx, vy;
-        switch (type) {
-            case CLONE_FOREGROUND_GRADIENTS:
-                detail::computeWeightedGradientVectorField(background.getMat()(rbg),
-                                                           foreground.getMat()(rfg),
-                                                           vx, vy,
-                                                           1.f);
-                break;
-                
-            case CLONE_AVERAGED_GRADIENTS:
-                detail::computeWeightedGradientVectorField(background.getMat()(rbg),
-                                                           foreground.getMat()(rfg),
-                                                           vx, vy,
-                                                           0.5f);
-                break;
-                
-            case CLONE_MIXED_GRADIENTS:
-                detail::computeMixedGradientVectorField(background.getMat()(rbg),
-                                                        foreground.getMat()(rfg),
-                                                        vx, vy);
-                break;
-                
-            default:
-                break;
-        }
-        
-        
-        // For the Poisson equation the divergence of the guidance field is necessary.
-        cv::Mat vxx, vyy;
-        cv::Mat kernelx = (cv::Mat_<float>(1, 3) << -0.5, 0, 0.5);
-        cv::Mat kernely = (cv::Mat_<float>(3, 1) << -0.5, 0, 0.5);
-        cv::filter2D(vx, vxx, CV_32F, kernelx);
-        cv::filter2D(vy, vyy, CV_32F, kernely);
-        
-        cv::Mat f = vxx + vyy;
+        // For the Poisson equation the divergence of the guidance vector field is necessary.
+        cv::Mat f;
+        detail::computeGuidanceFieldDivergence(background.getMat()(rbg),
+                                               foreground.getMat()(rfg),
+                                               f,
+                                               type);
                 
         cv::Mat boundaryMask(rfg.size(), CV_8UC1);      
         cv::threshold(foregroundMask.getMat()(rfg), boundaryMask, constants::UNKNOWN, constants::DIRICHLET_BD, cv::THRESH_BINARY_INV);
@@ -185,7 +327,8 @@ namespace blend {
         solvePoissonEquations(f,
                               boundaryMask,
                               boundaryValues,
-                              result);
+                              result,
+                              solver);
         
         // Copy result to destination image.
         result.convertTo(destination.getMat()(rbg), CV_8U);
@@ -193,4 +336,74 @@ namespace blend {
     }
     
     
+    void seamlessCloneBatch(cv::InputArray background,
+                            const std::vector<cv::Mat> &foregrounds,
+                            cv::InputArray foregroundMask,
+                            int offsetX,
+                            int offsetY,
+                            std::vector<cv::Mat> &destinations,
+                            CloneType type,
+                            SolverType solver)
+    {
+        const cv::Mat bg = background.getMat();
+        const int channels = bg.channels();
+        const int n = static_cast<int>(foregrounds.size());
+        
+        // Copy original background as we only solve for the overlapping area of the translated foreground mask.
+        destinations.resize(n);
+        for (int i = 0; i < n; ++i) {
+            CV_Assert(foregrounds[i].size() == foregrounds[0].size() && foregrounds[i].type() == bg.type());
+            bg.copyTo(destinations[i]);
+        }
+        
+        cv::Rect rbg, rfg;
+        if (n == 0 || !detail::findCloneRegion(background, foregrounds[0], foregroundMask, offsetX, offsetY, rbg, rfg))
+            return;
+        
+        cv::Mat boundaryMask(rfg.size(), CV_8UC1);      
+        cv::threshold(foregroundMask.getMat()(rfg), boundaryMask, constants::UNKNOWN, constants::DIRICHLET_BD, cv::THRESH_BINARY_INV);
+        cv::rectangle(boundaryMask, cv::Rect(0, 0, boundaryMask.cols, boundaryMask.rows), constants::DIRICHLET_BD, 1);
+        
+        cv::Mat boundaryValues(rfg.size(), CV_MAKETYPE(CV_32F, channels));
+        bg(rbg).convertTo(boundaryValues, CV_32F);
+        
+        // Foregrounds are stacked as channels, so that all right hand sides are back-substituted together 
+        // from one factorization. Batches are limited by the maximum number of channels of a matrix.
+        PoissonSolver poisson(solver);
+        const int batchSize = std::max(1, CV_CN_MAX / channels);
+        
+        for (int first = 0; first < n; first += batchSize) {
+            const int count = std::min(batchSize, n - first);
+            
+            std::vector<cv::Mat> fs(count), bvs(count, boundaryValues);
+            for (int i = 0; i < count; ++i) {
+                detail::computeGuidanceFieldDivergence(bg(rbg), foregrounds[first + i](rfg), fs[i], type);
+            }
+            
+            cv::Mat f, bv;
+            cv::merge(fs, f);
+            cv::merge(bvs, bv);
+            
+            // Solve Poisson equations
+            cv::Mat result;
+            poisson.solve(f, boundaryMask, bv, result);
+            
+            // Copy results to destination images.
+            std::vector<cv::Mat> results(count);
+            std::vector<int> fromTo;
+            for (int i = 0; i < count; ++i) {
+                results[i].create(rfg.size(), CV_MAKETYPE(CV_32F, channels));
+                for (int c = 0; c < channels; ++c) {
+                    fromTo.push_back(i * channels + c);
+                    fromTo.push_back(i * channels + c);
+                }
+            }
+            cv::mixChannels(&result, 1, &results[0], count, &fromTo[0], fromTo.size() / 2);
+            
+            for (int i = 0; i < count; ++i) {
+                results[i].convertTo(destinations[first + i](rbg), CV_8U);
+            }
+        }
+    }
+    
 }
\ No newline at end of file
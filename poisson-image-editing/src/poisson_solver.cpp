@@ -26,6 +26,9 @@
 #include <Eigen/Dense>
 #pragma warning (pop)
 #include <bitset>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
 
 namespace blend {       
 
@@ -59,189 +62,850 @@ namespace blend {
         return pixelToIndex;
     }
     
-    void solvePoissonEquations(
-        cv::InputArray f_,
-        cv::InputArray bdMask_,
-        cv::InputArray bdValues_,
-        cv::OutputArray result_)
+    /* Hash of mask content and dimensions, used to key cached factorizations. */
+    uint64_t hashMask(const cv::Mat_<uchar> &m)
     {
-        // Input validation
+        // 64 bit FNV-1a
+        uint64_t h = 14695981039346656037ULL;
+        const uint64_t prime = 1099511628211ULL;
 
-        CV_Assert(
-            !f_.empty() &&
-            isSameSize(f_.size(), bdMask_.size()) &&
-            isSameSize(f_.size(), bdValues_.size())
-        );
+        h = (h ^ static_cast<uint64_t>(m.rows)) * prime;
+        h = (h ^ static_cast<uint64_t>(m.cols)) * prime;
 
-        CV_Assert(
-            f_.depth() == CV_32F &&
-            bdMask_.depth() == CV_8U &&
-            bdValues_.depth() == CV_32F &&
-            f_.channels() == bdValues_.channels() &&
-            bdMask_.channels() == 1);
+        const uchar *maskPtr = m.ptr<uchar>();
+        for (int id = 0; id < (m.rows * m.cols); ++id) {
+            h = (h ^ maskPtr[id]) * prime;
+        }
 
-        // We assume continuous memory on input
-        cv::Mat f = makeContinuous(f_.getMat());
-        cv::Mat_<uchar> bm = makeContinuous(bdMask_.getMat());
-        cv::Mat bv = makeContinuous(bdValues_.getMat());
+        return h;
+    }
 
-        // Allocate output
-        result_.create(f.size(), f.type());
-        cv::Mat r = result_.getMat();
-        bv.copyTo(r, bm == constants::DIRICHLET_BD);
+    // Directional indices
+    const int center = 0;
+    const int north = 1;
+    const int east = 2;
+    const int south = 3;
+    const int west = 4;
+
+    // Neighbor offsets in all directions
+    const int offsets[5][2] = { { 0, 0 }, { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+
+    // Directional opposite
+    const int opposite[5] = { center, south, west, north, east };
+
+    /* 
+        Build the equation of unknown pixel p. The stencil coefficients only depend on the boundary 
+        mask. When rhs is given, f and the boundary contributions of bv are accumulated into it.
+    */
+    void buildEquation(const cv::Mat_<uchar> &bm,
+                       const cv::Mat &f,
+                       const cv::Mat &bv,
+                       const cv::Point &p,
+                       float lhs[5],
+                       float *rhs)
+    {
+        const cv::Rect bounds(0, 0, bm.cols, bm.rows);
+        const int channels = bv.channels();
+
+        // Start coefficients of left hand side. Based on discrete Laplacian with central difference.
+        const float laplacian[] = { -4.f, 1.f, 1.f, 1.f, 1.f };
+        std::copy(laplacian, laplacian + 5, lhs);
+
+        const bool hasNeumann = (bm(p) == constants::NEUMANN_BD);
+
+        if (hasNeumann) {
+            
+            // Implementation note:
+            //
+            // We first sweep over all neighbors and apply Neumann boundary (NB) conditions if necessary.
+            // NBs are currently only applied if the neighbor is not in the domain or it has Dirichlet
+            // boundary condition (DB).
+            //
+            // When the neighbor is not available we introduce ghost points which are immediately
+            // removed by substitution. Assume that we are at a pixel C at the top border (not corner)
+            // and that pixel is assigned a NB = 1. Denoting the pixels C, N, E, S, W we have for C
+            // the Laplacian
+            //      1: -4C + N + E + S + W = f(x)
+            // From NB we have
+            //      2: (N - S) * 0.5 = 1
+            // As N is not in the domain we need to get rid of it through substitution. Rewriting 2:
+            //      N = 2 + S
+            // and substituting in 1:
+            //      -4C + (2 + S) + E + S + W = f(x)
+            //      -4C + E + 2S + W = f(x) - 2
+            //
+            // When S is not available either, there is nothing to substitute: the axis is dropped
+            // from the Laplacian, which is then -2C + E + W along the other one.
+            
+            for (int n = 1; n < 5; ++n) {
+                const cv::Point q(p.x + offsets[n][0], p.y + offsets[n][1]);
+                const cv::Point o(p.x + offsets[opposite[n]][0], p.y + offsets[opposite[n]][1]);
+                
+                if (!bounds.contains(q) || bm(q) == constants::DIRICHLET_BD) {
+                    if (bounds.contains(o) && bm(o) != constants::DIRICHLET_BD) {
+                        lhs[opposite[n]] += 1.0f;
+                        if (rhs) {
+                            Eigen::Map<Eigen::VectorXf>(rhs, channels) += 2.f * Eigen::Map<const Eigen::VectorXf>(bv.ptr<float>(p.y, p.x), channels);
+                        }
+                    } else {
+                        lhs[center] += 1.0f;
+                    }
+                    lhs[n] = 0.f;
+                }
+            }
+        }
+        
+        for (int n = 1; n < 5; ++n) {
+            const cv::Point q(p.x + offsets[n][0], p.y + offsets[n][1]);
+            
+            const bool hasNeighbor = bounds.contains(q);
+            const bool isNeighborDirichlet = hasNeighbor && (bm(q) == constants::DIRICHLET_BD);
+            
+            if (!hasNeumann && !hasNeighbor) {
+                lhs[center] += lhs[n];
+                lhs[n] = 0.f;
+            } else if (isNeighborDirichlet) {
+                
+                // Implementation note:
+                //
+                // Dirichlet boundary conditions (DB) turn neighbor unknowns into knowns (data) and
+                // are therefore moved to the right hand side. Alternatively, we could add more
+                // equations for these pixels setting the lhs 1 and rhs to the Dirichlet value, but
+                // that would unnecessarily blow up the equation system.
+                
+                if (rhs) {
+                    Eigen::Map<Eigen::VectorXf>(rhs, channels) -= lhs[n] * Eigen::Map<const Eigen::VectorXf>(bv.ptr<float>(q.y, q.x), channels);
+                }
+                lhs[n] = 0.f;
+            }
+        }
 
-        // The number of unknowns correspond to the number of pixels on the rectangular region 
-        // that don't have a Dirichlet boundary condition.
-        int nUnknowns = 0;
-        cv::Mat_<int> unknownIdx = buildPixelToIndexLookup(bm, nUnknowns);
+        // Add f to rhs.
+        if (rhs) {
+            Eigen::Map<Eigen::VectorXf>(rhs, channels) += Eigen::Map<const Eigen::VectorXf>(f.ptr<float>(p.y, p.x), channels);
+        }
+    }
 
-        if (nUnknowns == 0) {
-            // No unknowns left, we're done
-            return;
-        } else if (nUnknowns == f.size().area()) {
-            // All unknowns, will not lead to a unique solution
-            // TODO emit warning
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrixXf;
+
+    // Stencil directions in increasing order of unknown index, as compressed storage keeps sorted indices.
+    const int sortedDirections[5] = { north, west, center, east, south };
+
+    /* Counts the non-zero coefficients of each unknown's equation into the outer index array, shifted by one. */
+    class CountNonZeros : public cv::ParallelLoopBody {
+    public:
+        CountNonZeros(const cv::Mat_<uchar> &bm,
+                      const cv::Mat_<int> &unknownIdx,
+                      int *outer)
+            : _bm(bm), _unknownIdx(unknownIdx), _outer(outer)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            for (int y = rows.start; y < rows.end; ++y) {
+                for (int x = 0; x < _bm.cols; ++x) {
+
+                    const cv::Point p(x, y);
+                    const int pid = _unknownIdx(p);
+
+                    if (pid == -1) {
+                        continue;
+                    }
+
+                    float lhs[5];
+                    buildEquation(_bm, cv::Mat(), cv::Mat(), p, lhs, 0);
+
+                    int count = 0;
+                    for (int n = 0; n < 5; ++n) {
+                        count += (lhs[n] != 0.f);
+                    }
+                    _outer[pid + 1] = count;
+                }
+            }
         }
 
-        const cv::Rect bounds(0, 0, f.cols, f.rows);
+    private:
+        const cv::Mat_<uchar> &_bm;
+        const cv::Mat_<int> &_unknownIdx;
+        int *_outer;
+    };
+
+    /* 
+        Fills the equations of a range of image rows into compressed storage. Equation pid is written 
+        as outer vector pid, which yields A in row major (CSR) or its transpose in column major (CSC) order.
+    */
+    class FillEquations : public cv::ParallelLoopBody {
+    public:
+        FillEquations(const cv::Mat_<uchar> &bm,
+                      const cv::Mat_<int> &unknownIdx,
+                      const int *outer,
+                      int *inner,
+                      float *values)
+            : _bm(bm), _unknownIdx(unknownIdx), _outer(outer), _inner(inner), _values(values)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            for (int y = rows.start; y < rows.end; ++y) {
+                for (int x = 0; x < _bm.cols; ++x) {
+
+                    const cv::Point p(x, y);
+                    const int pid = _unknownIdx(p);
+
+                    if (pid == -1) {
+                        continue;
+                    }
 
-        // Directional indices
-        const int center = 0;
-        const int north = 1;
-        const int east = 2;
-        const int south = 3;
-        const int west = 4;
+                    float lhs[5];
+                    buildEquation(_bm, cv::Mat(), cv::Mat(), p, lhs, 0);
 
-        // Neighbor offsets in all directions
-        const int offsets[5][2] = { { 0, 0 }, { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
-        
-        // Directional opposite
-        const int opposite[5] = { center, south, west, north, east };
-        const int channels = f.channels();
-        
-        std::vector< Eigen::Triplet<float> > lhsTriplets;
-        lhsTriplets.reserve(nUnknowns * 5);
+                    int k = _outer[pid];
+                    for (int i = 0; i < 5; ++i) {
+                        const int n = sortedDirections[i];
+                        if (lhs[n] != 0.f) {
+                            _inner[k] = _unknownIdx(y + offsets[n][1], x + offsets[n][0]);
+                            _values[k] = lhs[n];
+                            ++k;
+                        }
+                    }
+                }
+            }
+        }
 
-        Eigen::MatrixXf rhs(nUnknowns, channels);
-        rhs.setZero();
-        
-        // Loop over domain once. The coefficient matrix A is the same for all
-        // channels, the right hand side is channel dependent.
+    private:
+        const cv::Mat_<uchar> &_bm;
+        const cv::Mat_<int> &_unknownIdx;
+        const int *_outer;
+        int *_inner;
+        float *_values;
+    };
+
+    /* 
+        Assemble the coefficient matrix directly in compressed form. Equations are written in row 
+        order with exact preallocation, skipping the triplet sort. 
+    */
+    Eigen::SparseMatrix<float> buildCoefficientMatrix(const cv::Mat_<uchar> &bm,
+                                                      const cv::Mat_<int> &unknownIdx,
+                                                      int nUnknowns,
+                                                      bool symmetric)
+    {
+        // Row pid of A is stored as column pid, i.e. this holds A^T.
+        Eigen::SparseMatrix<float> At(nUnknowns, nUnknowns);
+        int *outer = At.outerIndexPtr();
+
+        outer[0] = 0;
+        cv::parallel_for_(cv::Range(0, bm.rows), CountNonZeros(bm, unknownIdx, outer));
+        for (int i = 0; i < nUnknowns; ++i) {
+            outer[i + 1] += outer[i];
+        }
 
-        for (int y = 0; y < f.rows; ++y) {
-            for (int x = 0; x < r.cols; ++x) {
+        At.resizeNonZeros(outer[nUnknowns]);
+        cv::parallel_for_(cv::Range(0, bm.rows), FillEquations(bm, unknownIdx, outer, At.innerIndexPtr(), At.valuePtr()));
 
-                const cv::Point p(x, y);
-                const int pid = unknownIdx(p);
+        if (symmetric) {
+            return At;
+        }
+        return Eigen::SparseMatrix<float>(At.transpose());
+    }
 
-                if (pid == -1) {
-                    // Current pixel is not an unknown, skip
-                    continue;
+    /* Builds the right hand side rows of a range of image rows. Each unknown owns its row. */
+    class BuildRhs : public cv::ParallelLoopBody {
+    public:
+        BuildRhs(const cv::Mat_<uchar> &bm,
+                 const cv::Mat &f,
+                 const cv::Mat &bv,
+                 const cv::Mat_<int> &unknownIdx,
+                 RowMajorMatrixXf &rhs)
+            : _bm(bm), _f(f), _bv(bv), _unknownIdx(unknownIdx), _rhs(rhs)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            for (int y = rows.start; y < rows.end; ++y) {
+                for (int x = 0; x < _bm.cols; ++x) {
+
+                    const cv::Point p(x, y);
+                    const int pid = _unknownIdx(p);
+
+                    if (pid == -1) {
+                        continue;
+                    }
+
+                    float lhs[5];
+                    buildEquation(_bm, _f, _bv, p, lhs, _rhs.row(pid).data());
                 }
+            }
+        }
 
-                // Start coefficients of left hand side. Based on discrete Laplacian with central difference.
-                float lhs[] = { -4.f, 1.f, 1.f, 1.f, 1.f };
-                
-                const bool hasNeumann = (bm(p) == constants::NEUMANN_BD);
+    private:
+        const cv::Mat_<uchar> &_bm;
+        const cv::Mat &_f;
+        const cv::Mat &_bv;
+        const cv::Mat_<int> &_unknownIdx;
+        RowMajorMatrixXf &_rhs;
+    };
+
+    /* Copies the solution of a range of image rows back to the result image. */
+    class ScatterResult : public cv::ParallelLoopBody {
+    public:
+        ScatterResult(const Eigen::MatrixXf &result,
+                      const cv::Mat_<int> &unknownIdx,
+                      cv::Mat &r)
+            : _result(result), _unknownIdx(unknownIdx), _r(r)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            const int channels = _r.channels();
+
+            for (int y = rows.start; y < rows.end; ++y) {
+                for (int x = 0; x < _r.cols; ++x) {
+                    const int pid = _unknownIdx(y, x);
+
+                    if (pid > -1) {
+                        Eigen::Map<Eigen::VectorXf>(_r.ptr<float>(y, x), channels) = _result.row(pid);
+                    }
+                }
+            }
+        }
+
+    private:
+        const Eigen::MatrixXf &_result;
+        const cv::Mat_<int> &_unknownIdx;
+        cv::Mat &_r;
+    };
+
+    /* Relative residual at which the matrix-free solver stops. */
+    const double matrixFreeTolerance = 1e-6;
+
+    /* 
+        Applies the coefficient matrix to a vector defined over the whole image. Entries of Dirichlet 
+        pixels are kept zero, their contribution lives in the right hand side.
+    */
+    class ApplyStencil : public cv::ParallelLoopBody {
+    public:
+        ApplyStencil(const cv::Mat_<uchar> &bm, const float *x, float *ax)
+            : _bm(bm), _x(x), _ax(ax)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            const cv::Rect bounds(0, 0, _bm.cols, _bm.rows);
+            const int cols = _bm.cols;
+
+            for (int y = rows.start; y < rows.end; ++y) {
+                const uchar *maskRow = _bm[y];
                 
-                if (hasNeumann) {
-                    
-                    // Implementation note:
-                    //
-                    // We first sweep over all neighbors and apply Neumann boundary (NB) conditions if necessary.
-                    // NBs are currently only applied if the neighbor is not in the domain or it has Dirichlet
-                    // boundary condition (DB).
-                    //
-                    // When the neighbor is not available we introduce ghost points which are immediately
-                    // removed by substitution. Assume that we are at a pixel C at the top border (not corner)
-                    // and that pixel is assigned a NB = 1. Denoting the pixels C, N, E, S, W we have for C
-                    // the Laplacian
-                    //      1: -4C + N + E + S + W = f(x)
-                    // From NB we have
-                    //      2: (N - S) * 0.5 = 1
-                    // As N is not in the domain we need to get rid of it through substitution. Rewriting 2:
-                    //      N = 2 + S
-                    // and substituting in 1:
-                    //      -4C + (2 + S) + E + S + W = f(x)
-                    //      -4C + E + 2S + W = f(x) - 2
+                for (int x = 0; x < cols; ++x) {
+                    const int id = y * cols + x;
                     
-                    for (int n = 1; n < 5; ++n) {
-                        const cv::Point q(x + offsets[n][0], y + offsets[n][1]);
-                        
-                        if (!bounds.contains(q) || bm(q) == constants::DIRICHLET_BD) {
-                            lhs[opposite[n]] += 1.0f;
-                            lhs[n] = 0.f;
-                            rhs.row(pid) += 2.f * Eigen::Map<Eigen::VectorXf>(bv.ptr<float>(p.y, p.x), channels);
+                    if (maskRow[x] == constants::DIRICHLET_BD) {
+                        _ax[id] = 0.f;
+                    } else if (maskRow[x] != constants::NEUMANN_BD && x > 0 && y > 0 && x < cols - 1 && y < _bm.rows - 1) {
+                        // Interior pixel, Dirichlet neighbors read as zero.
+                        _ax[id] = -4.f * _x[id] + _x[id - 1] + _x[id + 1] + _x[id - cols] + _x[id + cols];
+                    } else {
+                        float lhs[5];
+                        buildEquation(_bm, cv::Mat(), cv::Mat(), cv::Point(x, y), lhs, 0);
+
+                        float sum = 0.f;
+                        for (int n = 0; n < 5; ++n) {
+                            const cv::Point q(x + offsets[n][0], y + offsets[n][1]);
+                            if (lhs[n] != 0.f && bounds.contains(q)) {
+                                sum += lhs[n] * _x[q.y * cols + q.x];
+                            }
                         }
+                        _ax[id] = sum;
                     }
                 }
-                
-                for (int n = 1; n < 5; ++n) {
-                    const cv::Point q(x + offsets[n][0], y + offsets[n][1]);
-                    
-                    const bool hasNeighbor = bounds.contains(q);
-                    const bool isNeighborDirichlet = hasNeighbor && (bm(q) == constants::DIRICHLET_BD);
-                    
-                    if (!hasNeumann && !hasNeighbor) {
-                        lhs[center] += lhs[n];
-                        lhs[n] = 0.f;
-                    } else if (isNeighborDirichlet) {
-                        
-                        // Implementation note:
-                        //
-                        // Dirichlet boundary conditions (DB) turn neighbor unknowns into knowns (data) and
-                        // are therefore moved to the right hand side. Alternatively, we could add more
-                        // equations for these pixels setting the lhs 1 and rhs to the Dirichlet value, but
-                        // that would unnecessarily blow up the equation system.
-                        
-                        rhs.row(pid) -= lhs[n] * Eigen::Map<Eigen::VectorXf>(bv.ptr<float>(q.y, q.x), channels);
-                        lhs[n] = 0.f;
+            }
+        }
+
+    private:
+        const cv::Mat_<uchar> &_bm;
+        const float *_x;
+        float *_ax;
+    };
+
+    /* Builds the right hand side over the whole image, zero at Dirichlet pixels. */
+    class BuildImageRhs : public cv::ParallelLoopBody {
+    public:
+        BuildImageRhs(const cv::Mat_<uchar> &bm,
+                      const cv::Mat &f,
+                      const cv::Mat &bv,
+                      RowMajorMatrixXf &rhs)
+            : _bm(bm), _f(f), _bv(bv), _rhs(rhs)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            for (int y = rows.start; y < rows.end; ++y) {
+                for (int x = 0; x < _bm.cols; ++x) {
+                    if (_bm(y, x) != constants::DIRICHLET_BD) {
+                        float lhs[5];
+                        buildEquation(_bm, _f, _bv, cv::Point(x, y), lhs, _rhs.row(y * _bm.cols + x).data());
+                    }
+                }
+            }
+        }
+
+    private:
+        const cv::Mat_<uchar> &_bm;
+        const cv::Mat &_f;
+        const cv::Mat &_bv;
+        RowMajorMatrixXf &_rhs;
+    };
+
+    /* 
+        Builds the inverse diagonal of the coefficient matrix, the Jacobi preconditioner of the matrix-free
+        solver. Dirichlet entries stay zero like the vectors they scale.
+    */
+    class BuildInverseDiagonal : public cv::ParallelLoopBody {
+    public:
+        BuildInverseDiagonal(const cv::Mat_<uchar> &bm, float *invDiag)
+            : _bm(bm), _invDiag(invDiag)
+        {}
+
+        void operator()(const cv::Range &rows) const {
+            const int cols = _bm.cols;
+
+            for (int y = rows.start; y < rows.end; ++y) {
+                const uchar *maskRow = _bm[y];
+
+                for (int x = 0; x < cols; ++x) {
+                    const int id = y * cols + x;
+
+                    if (maskRow[x] == constants::DIRICHLET_BD) {
+                        _invDiag[id] = 0.f;
+                    } else if (maskRow[x] != constants::NEUMANN_BD && x > 0 && y > 0 && x < cols - 1 && y < _bm.rows - 1) {
+                        _invDiag[id] = -0.25f;
+                    } else {
+                        float lhs[5];
+                        buildEquation(_bm, cv::Mat(), cv::Mat(), cv::Point(x, y), lhs, 0);
+                        // Both axes dropped leaves an empty row, which is left unscaled.
+                        _invDiag[id] = (lhs[center] != 0.f) ? 1.f / lhs[center] : 1.f;
                     }
                 }
+            }
+        }
+
+    private:
+        const cv::Mat_<uchar> &_bm;
+        float *_invDiag;
+    };
+
+    double dot(const Eigen::VectorXf &a, const Eigen::VectorXf &b) {
+        return a.cast<double>().dot(b.cast<double>());
+    }
+
+    /* 
+        Solve A x = b without assembling A. The stencil is applied directly on the boundary mask; conjugate 
+        gradient is used when A is symmetric, BiCGSTAB otherwise, both preconditioned by the diagonal of A. 
+        x holds the initial guess on input.
+
+        Returns false when the relative residual does not reach matrixFreeTolerance within 
+        10 * (rows + cols) + 100 iterations, or when the iteration breaks down or diverges. The Jacobi preconditioner 
+        only rescales boundary rows, so the iteration count still grows with the extent of the domain; 
+        the budget covers well conditioned Dirichlet problems with room to spare.
+    */
+    bool solveMatrixFree(const cv::Mat_<uchar> &bm, const Eigen::VectorXf &b, Eigen::VectorXf &x, bool symmetric)
+    {
+        const int n = static_cast<int>(b.size());
+        const int maxIterations = 10 * (bm.rows + bm.cols) + 100;
+
+        const double bNorm2 = dot(b, b);
+        if (bNorm2 == 0.0) {
+            x.setZero();
+            return true;
+        }
+        const double threshold = matrixFreeTolerance * matrixFreeTolerance * bNorm2;
+
+        const cv::Range rows(0, bm.rows);
+        Eigen::VectorXf invDiag(n), r(n), z(n), p(n), v(n);
+
+        cv::parallel_for_(rows, BuildInverseDiagonal(bm, invDiag.data()));
+        cv::parallel_for_(rows, ApplyStencil(bm, x.data(), v.data()));
+        r = b - v;
+
+        if (symmetric) {
+            
+            // Conjugate gradient. A and its diagonal are negative definite, which leaves the iteration unchanged.
+            
+            z = invDiag.cwiseProduct(r);
+            p = z;
+            double rz = dot(r, z);
+
+            for (int i = 0; i < maxIterations; ++i) {
+                const double rr = dot(r, r);
+                if (rr <= threshold) {
+                    return true;
+                } else if (!std::isfinite(rr)) {
+                    return false;
+                }
+
+                cv::parallel_for_(rows, ApplyStencil(bm, p.data(), v.data()));
+                const double pv = dot(p, v);
+                if (pv == 0.0) {
+                    return false;
+                }
+                const float alpha = static_cast<float>(rz / pv);
+                x += alpha * p;
+                r -= alpha * v;
+
+                z = invDiag.cwiseProduct(r);
+                const double rzNext = dot(r, z);
+                p = z + static_cast<float>(rzNext / rz) * p;
+                rz = rzNext;
+            }
+            return dot(r, r) <= threshold;
+        }
+
+        // BiCGSTAB for the non-symmetric Neumann rows, preconditioned on the right.
+
+        const Eigen::VectorXf r0 = r;
+        Eigen::VectorXf s(n), t(n);
+        p.setZero();
+        v.setZero();
+        double rho = 1.0, alpha = 1.0, omega = 1.0;
+
+        for (int i = 0; i < maxIterations; ++i) {
+            // In single precision the residual may stall above the tolerance and diverge.
+            const double rr = dot(r, r);
+            if (rr <= threshold) {
+                return true;
+            } else if (!std::isfinite(rr)) {
+                return false;
+            }
+
+            const double rhoNext = dot(r0, r);
+            if (rhoNext == 0.0) {
+                return false;
+            }
+            const double beta = (rhoNext / rho) * (alpha / omega);
+            rho = rhoNext;
+
+            p = r + static_cast<float>(beta) * (p - static_cast<float>(omega) * v);
+            z = invDiag.cwiseProduct(p);
+            cv::parallel_for_(rows, ApplyStencil(bm, z.data(), v.data()));
+            const double r0v = dot(r0, v);
+            if (r0v == 0.0) {
+                return false;
+            }
+            alpha = rho / r0v;
+            x += static_cast<float>(alpha) * z;
+            s = r - static_cast<float>(alpha) * v;
+
+            if (dot(s, s) <= threshold) {
+                return true;
+            }
 
+            z = invDiag.cwiseProduct(s);
+            cv::parallel_for_(rows, ApplyStencil(bm, z.data(), t.data()));
+            const double tt = dot(t, t);
+            omega = (tt != 0.0) ? dot(t, s) / tt : 0.0;
+            if (omega == 0.0) {
+                return false;
+            }
+            x += static_cast<float>(omega) * z;
+            r = s - static_cast<float>(omega) * t;
+        }
+        return dot(r, r) <= threshold;
+    }
 
-                // Add f to rhs.
-                rhs.row(pid) += Eigen::Map<Eigen::VectorXf>(f.ptr<float>(p.y, p.x), channels);
+    /* 
+        Solve all channels with the matrix-free solver, writing unknown pixels of r. Vectors span the whole 
+        image, Dirichlet pixels stay zero. Channels are solved in sequence to keep the number of image sized 
+        vectors low. Returns false as soon as a channel does not converge.
+    */
+    bool solveChannelsMatrixFree(const cv::Mat &f, const cv::Mat_<uchar> &bm, const cv::Mat &bv, cv::Mat &r)
+    {
+        const int channels = f.channels();
+        const int npixel = f.rows * f.cols;
+        const bool symmetric = cv::countNonZero(bm == constants::NEUMANN_BD) == 0;
 
-                // Build triplets for row              
-                for (int n = 0; n < 5; ++n) {
-                    if (lhs[n] != 0.f) {
-                        const cv::Point q(x + offsets[n][0], y + offsets[n][1]);
-                        lhsTriplets.push_back(Eigen::Triplet<float>(pid, unknownIdx(q), lhs[n]));
+        RowMajorMatrixXf rhs(npixel, channels);
+        rhs.setZero();
+        cv::parallel_for_(cv::Range(0, f.rows), BuildImageRhs(bm, f, bv, rhs));
+
+        Eigen::VectorXf b(npixel), x(npixel);
+        const uchar *maskPtr = bm.ptr<uchar>();
+
+        for (int c = 0; c < channels; ++c) {
+            b = rhs.col(c);
+
+            // Start from the boundary values
+            const float *bvPtr = bv.ptr<float>();
+            for (int id = 0; id < npixel; ++id) {
+                x[id] = (maskPtr[id] == constants::DIRICHLET_BD) ? 0.f : bvPtr[id * channels + c];
+            }
+
+            if (!solveMatrixFree(bm, b, x, symmetric)) {
+                return false;
+            }
+
+            // The result may be a view
+            for (int y = 0; y < r.rows; ++y) {
+                float *rRow = r.ptr<float>(y);
+                for (int xi = 0; xi < r.cols; ++xi) {
+                    const int id = y * r.cols + xi;
+                    if (maskPtr[id] != constants::DIRICHLET_BD) {
+                        rRow[xi * channels + c] = x[id];
                     }
                 }
-                    
             }
         }
+        return true;
+    }
 
-        // Solve the sparse linear system of equations
+    struct PoissonSolver::Factorization {
+        uint64_t maskHash;
+        cv::Mat_<uchar> mask;
+        int nUnknowns;
+        cv::Mat_<int> unknownIdx;
+        SolverType type;
+
+        // The symmetric solvers operate on -A, which is positive definite for pure Dirichlet problems.
+        Eigen::SparseMatrix<float> negA;
+        Eigen::SparseLU< Eigen::SparseMatrix<float> > lu;
+        Eigen::SimplicialLDLT< Eigen::SparseMatrix<float> > ldlt;
+        Eigen::SimplicialLLT< Eigen::SparseMatrix<float> > llt;
+        Eigen::ConjugateGradient< Eigen::SparseMatrix<float>, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<float> > cg;
+
+        /* True when built for mask |m| of hash |h|. Only masks with the same hash are compared, the copy rules out collisions. */
+        bool matches(const cv::Mat_<uchar> &m, uint64_t h) const
+        {
+            if (maskHash != h || !isSameSize(mask.size(), m.size())) {
+                return false;
+            }
+            const uchar *maskPtr = m.ptr<uchar>();
+            return std::equal(maskPtr, maskPtr + m.rows * m.cols, mask.ptr<uchar>());
+        }
 
-        Eigen::SparseMatrix<float> A(nUnknowns, nUnknowns);
-        A.setFromTriplets(lhsTriplets.begin(), lhsTriplets.end());
+        void factorize(const Eigen::SparseMatrix<float> &A, SolverType requested, bool hasNeumann)
+        {
+            type = requested;
 
-        Eigen::SparseLU< Eigen::SparseMatrix<float> > solver;
-        solver.analyzePattern(A);
-        solver.factorize(A);
+            if (type != SOLVER_SPARSE_LU && hasNeumann) {
+                // Neumann rows break symmetry
+                const Eigen::SparseMatrix<float> At = A.transpose();
+                if ((A - At).squaredNorm() != 0.f) {
+                    type = SOLVER_SPARSE_LU;
+                }
+            }
 
-        Eigen::MatrixXf result(nUnknowns, channels);
-        for (int c = 0; c < channels; ++c)
-            result.col(c) = solver.solve(rhs.col(c));
-        
+            bool success = false;
+            switch (type) {
+                case SOLVER_SIMPLICIAL_LDLT:
+                    negA = -A;
+                    ldlt.compute(negA);
+                    success = (ldlt.info() == Eigen::Success);
+                    break;
+
+                case SOLVER_SIMPLICIAL_LLT:
+                    negA = -A;
+                    llt.compute(negA);
+                    success = (llt.info() == Eigen::Success);
+                    break;
+
+                case SOLVER_CONJUGATE_GRADIENT:
+                    // The solver keeps a reference to negA.
+                    negA = -A;
+                    cg.setTolerance(1e-5f);
+                    cg.compute(negA);
+                    success = (cg.info() == Eigen::Success);
+                    break;
+
+                default:
+                    break;
+            }
 
-        // Copy results back
+            if (!success) {
+                negA.resize(0, 0);
+                factorizeLU(A);
+            }
+        }
 
-        for (int y = 0; y < f.rows; ++y) {
-            for (int x = 0; x < f.cols; ++x) {
-                const cv::Point p(x, y);
-                const int pid = unknownIdx(p);
+        /* Switch to the sparse LU factorization of A. */
+        void factorizeLU(const Eigen::SparseMatrix<float> &A)
+        {
+            type = SOLVER_SPARSE_LU;
+            lu.analyzePattern(A);
+            lu.factorize(A);
+        }
 
-                if (pid > -1) {
-                    Eigen::Map<Eigen::VectorXf>(r.ptr<float>(p.y, p.x), channels) = result.row(pid);
+        /* 
+            Solve for all channels. Direct solvers back-substitute channels in parallel. When conjugate 
+            gradient does not reach its tolerance within its iteration limit, the system is factorized 
+            with SOLVER_SPARSE_LU instead, which is kept for the next solves.
+        */
+        void solve(const RowMajorMatrixXf &rhs, Eigen::MatrixXf &result)
+        {
+            if (type == SOLVER_CONJUGATE_GRADIENT) {
+                // Iterative solvers record statistics while solving, so channels are solved in sequence.
+                result = cg.solve(-rhs);
+                if (cg.info() == Eigen::Success) {
+                    return;
                 }
 
+                const Eigen::SparseMatrix<float> A = -negA;
+                negA.resize(0, 0);
+                factorizeLU(A);
+            }
+
+            class SolveChannels : public cv::ParallelLoopBody {
+            public:
+                SolveChannels(const Factorization &fac, const RowMajorMatrixXf &rhs, Eigen::MatrixXf &result)
+                    : _fac(fac), _rhs(rhs), _result(result)
+                {}
+
+                void operator()(const cv::Range &channels) const {
+                    for (int c = channels.start; c < channels.end; ++c) {
+                        _result.col(c) = _fac.solve(_rhs.col(c));
+                    }
+                }
+
+            private:
+                const Factorization &_fac;
+                const RowMajorMatrixXf &_rhs;
+                Eigen::MatrixXf &_result;
+            };
+
+            result.resize(rhs.rows(), rhs.cols());
+            cv::parallel_for_(cv::Range(0, static_cast<int>(rhs.cols())), SolveChannels(*this, rhs, result));
+        }
+
+        Eigen::VectorXf solve(const Eigen::VectorXf &rhs) const
+        {
+            switch (type) {
+                case SOLVER_SIMPLICIAL_LDLT:
+                    return ldlt.solve(-rhs);
+                case SOLVER_SIMPLICIAL_LLT:
+                    return llt.solve(-rhs);
+                case SOLVER_CONJUGATE_GRADIENT:
+                    return cg.solve(-rhs);
+                default:
+                    return lu.solve(rhs);
+            }
+        }
+    };
+
+    PoissonSolver::PoissonSolver(SolverType type)
+        : _type(type), _nFactorizations(0)
+    {}
+
+    PoissonSolver::~PoissonSolver()
+    {}
+
+    void PoissonSolver::clear()
+    {
+        _factorization.reset();
+    }
+
+    SolverType PoissonSolver::activeSolverType() const
+    {
+        return _factorization ? _factorization->type : _type;
+    }
+
+    int PoissonSolver::factorizationCount() const
+    {
+        return _nFactorizations;
+    }
+    
+    void PoissonSolver::solve(
+        cv::InputArray f_,
+        cv::InputArray bdMask_,
+        cv::InputArray bdValues_,
+        cv::OutputArray result_)
+    {
+        // Input validation
+
+        CV_Assert(
+            !f_.empty() &&
+            isSameSize(f_.size(), bdMask_.size()) &&
+            isSameSize(f_.size(), bdValues_.size())
+        );
+
+        CV_Assert(
+            f_.depth() == CV_32F &&
+            bdMask_.depth() == CV_8U &&
+            bdValues_.depth() == CV_32F &&
+            f_.channels() == bdValues_.channels() &&
+            bdMask_.channels() == 1);
+
+        // We assume continuous memory on input
+        cv::Mat f = makeContinuous(f_.getMat());
+        cv::Mat_<uchar> bm = makeContinuous(bdMask_.getMat());
+        cv::Mat bv = makeContinuous(bdValues_.getMat());
+
+        // Allocate output
+        result_.create(f.size(), f.type());
+        cv::Mat r = result_.getMat();
+        bv.copyTo(r, bm == constants::DIRICHLET_BD);
+
+        // Without convergence the matrix-free solver falls back to SOLVER_SPARSE_LU below.
+        if (_type == SOLVER_MATRIX_FREE && solveChannelsMatrixFree(f, bm, bv, r)) {
+            return;
+        }
+        const SolverType type = (_type == SOLVER_MATRIX_FREE) ? SOLVER_SPARSE_LU : _type;
+
+        // The coefficient matrix only depends on the boundary mask. Reuse the previous 
+        // factorization when the mask did not change.
+        const uint64_t maskHash = hashMask(bm);
+
+        if (!_factorization || !_factorization->matches(bm, maskHash)) {
+            _factorization.reset(new Factorization());
+            ++_nFactorizations;
+            Factorization &fac = *_factorization;
+            fac.maskHash = maskHash;
+            fac.mask = bm.clone();
+            fac.type = type;
+
+            // The number of unknowns correspond to the number of pixels on the rectangular region 
+            // that don't have a Dirichlet boundary condition.
+            fac.unknownIdx = buildPixelToIndexLookup(bm, fac.nUnknowns);
+
+            if (fac.nUnknowns == 0) {
+                // No unknowns left, we're done
+                return;
+            } else if (fac.nUnknowns == f.size().area()) {
+                // All unknowns, will not lead to a unique solution
+                // TODO emit warning
             }
+
+            // Without Neumann rows the matrix is symmetric and row order equals column order.
+            const bool hasNeumann = cv::countNonZero(bm == constants::NEUMANN_BD) > 0;
+            const Eigen::SparseMatrix<float> A = buildCoefficientMatrix(bm, fac.unknownIdx, fac.nUnknowns, !hasNeumann);
+
+            fac.factorize(A, type, hasNeumann);
+        }
+
+        Factorization &fac = *_factorization;
+        if (fac.nUnknowns == 0) {
+            return;
         }
 
+        // The right hand side is channel dependent. Every unknown owns one row, so image rows
+        // are assembled in parallel.
+
+        const int channels = f.channels();
+
+        RowMajorMatrixXf rhs(fac.nUnknowns, channels);
+        rhs.setZero();
+        cv::parallel_for_(cv::Range(0, f.rows), BuildRhs(bm, f, bv, fac.unknownIdx, rhs));
+
+        // Back-substitute
+
+        Eigen::MatrixXf result;
+        fac.solve(rhs, result);
+
+        // Copy results back
+
+        cv::parallel_for_(cv::Range(0, f.rows), ScatterResult(result, fac.unknownIdx, r));
+    }
+    
+    void solvePoissonEquations(
+        cv::InputArray f,
+        cv::InputArray bdMask,
+        cv::InputArray bdValues,
+        cv::OutputArray result,
+        SolverType type)
+    {
+        PoissonSolver solver(type);
+        solver.solve(f, bdMask, bdValues, result);
     }
 
-}
\ No newline at end of file
+}
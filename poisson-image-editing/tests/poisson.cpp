@@ -21,6 +21,8 @@ along with Poisson Image Editing.  If not, see <http://www.gnu.org/licenses/>.
 #include "catch.hpp"
 #include "test_config.h"
 #include <blend/poisson_solver.h>
+#include <blend/clone.h>
+#include <blend/blend.h>
 #include <opencv2/opencv.hpp>
 
 void showResult(cv::Mat initial, cv::Mat result)
@@ -111,3 +113,320 @@ TEST_CASE("Laplacian-2d")
     showResult(bvalues, result);
 #endif
 }
+
+TEST_CASE("Cached-factorization")
+{
+    const int width = 20;
+    const int height = 10;
+
+    cv::Mat f(height, width, CV_32FC1);
+    f.setTo(0);
+
+    cv::Mat bmask(height, width, CV_8UC1);
+    bmask.setTo(blend::constants::UNKNOWN);
+    bmask.col(0).setTo(blend::constants::DIRICHLET_BD);
+    bmask.col(width - 1).setTo(blend::constants::DIRICHLET_BD);
+
+    cv::Mat bvalues(height, width, CV_32FC1);
+    bvalues.setTo(0);
+    bvalues.col(width - 1).setTo(255);
+
+    blend::PoissonSolver solver;
+    cv::Mat result, expected;
+
+    // Same mask, new boundary values: the cached factorization must be reused correctly.
+    solver.solve(f, bmask, bvalues, result);
+    REQUIRE(solver.factorizationCount() == 1);
+    bvalues.col(0).setTo(100);
+    solver.solve(f, bmask, bvalues, result);
+    REQUIRE(solver.factorizationCount() == 1);
+    blend::solvePoissonEquations(f, bmask, bvalues, expected);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 1e-3);
+
+    // Equal mask in another matrix: still reused.
+    solver.solve(f, bmask.clone(), bvalues, result);
+    REQUIRE(solver.factorizationCount() == 1);
+
+    // Changed mask: the factorization must be rebuilt.
+    bmask.row(0).setTo(blend::constants::DIRICHLET_BD);
+    solver.solve(f, bmask, bvalues, result);
+    REQUIRE(solver.factorizationCount() == 2);
+    blend::solvePoissonEquations(f, bmask, bvalues, expected);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 1e-3);
+}
+
+TEST_CASE("Solver-types")
+{
+    const int width = 30;
+    const int height = 20;
+
+    cv::Mat f(height, width, CV_32FC3);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width * 3; ++x)
+            f.ptr<float>(y)[x] = static_cast<float>((x * 7 + y * 13) % 11) - 5.f;
+
+    cv::Mat bmask(height, width, CV_8UC1);
+    bmask.setTo(blend::constants::UNKNOWN);
+    cv::rectangle(bmask, cv::Rect(0, 0, width, height), blend::constants::DIRICHLET_BD, 1);
+
+    cv::Mat bvalues(height, width, CV_32FC3);
+    bvalues.setTo(cv::Scalar(10, 100, 200));
+
+    cv::Mat expected;
+    blend::solvePoissonEquations(f, bmask, bvalues, expected, blend::SOLVER_SPARSE_LU);
+
+    const blend::SolverType types[] = {
+        blend::SOLVER_SIMPLICIAL_LDLT,
+        blend::SOLVER_SIMPLICIAL_LLT,
+        blend::SOLVER_CONJUGATE_GRADIENT
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        blend::PoissonSolver solver(types[i]);
+        cv::Mat result;
+        solver.solve(f, bmask, bvalues, result);
+
+        REQUIRE(solver.activeSolverType() == types[i]);
+        REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 0.05);
+    }
+
+    // Neumann rows are not symmetric, solvers fall back to LU.
+    bmask.row(0).colRange(1, width - 1).setTo(blend::constants::NEUMANN_BD);
+    blend::solvePoissonEquations(f, bmask, bvalues, expected, blend::SOLVER_SPARSE_LU);
+
+    blend::PoissonSolver solver(blend::SOLVER_SIMPLICIAL_LDLT);
+    cv::Mat result;
+    solver.solve(f, bmask, bvalues, result);
+
+    REQUIRE(solver.activeSolverType() == blend::SOLVER_SPARSE_LU);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 1e-3);
+}
+
+TEST_CASE("Matrix-free")
+{
+    const int width = 40;
+    const int height = 30;
+
+    cv::Mat f(height, width, CV_32FC3);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width * 3; ++x)
+            f.ptr<float>(y)[x] = static_cast<float>((x * 7 + y * 13) % 11) - 5.f;
+
+    cv::Mat bmask(height, width, CV_8UC1);
+    bmask.setTo(blend::constants::UNKNOWN);
+    cv::rectangle(bmask, cv::Rect(0, 0, width, height), blend::constants::DIRICHLET_BD, 1);
+    cv::rectangle(bmask, cv::Rect(10, 10, 5, 5), blend::constants::DIRICHLET_BD, 1);
+
+    cv::Mat bvalues(height, width, CV_32FC3);
+    bvalues.setTo(cv::Scalar(10, 100, 200));
+    bvalues.col(0).setTo(cv::Scalar(250, 0, 50));
+
+    cv::Mat expected, result;
+    
+    // Symmetric system, solved by conjugate gradient
+    blend::solvePoissonEquations(f, bmask, bvalues, expected, blend::SOLVER_SPARSE_LU);
+    blend::solvePoissonEquations(f, bmask, bvalues, result, blend::SOLVER_MATRIX_FREE);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 0.05);
+
+    // Neumann rows, solved by BiCGSTAB
+    bmask.row(0).colRange(1, width - 1).setTo(blend::constants::NEUMANN_BD);
+    bmask.col(0).rowRange(1, height - 1).setTo(blend::constants::NEUMANN_BD);
+    blend::solvePoissonEquations(f, bmask, bvalues, expected, blend::SOLVER_SPARSE_LU);
+    blend::solvePoissonEquations(f, bmask, bvalues, result, blend::SOLVER_MATRIX_FREE);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 0.05);
+
+    // Converged without falling back to a factorization
+    blend::PoissonSolver solver(blend::SOLVER_MATRIX_FREE);
+    solver.solve(f, bmask, bvalues, result);
+    REQUIRE(solver.factorizationCount() == 0);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) < 0.05);
+
+    // Without any Dirichlet pixel the system is singular and the Krylov iteration does not converge,
+    // which falls back to sparse LU.
+    cv::Mat neumann(height, width, CV_8UC1);
+    neumann.setTo(blend::constants::NEUMANN_BD);
+    solver.solve(f, neumann, bvalues, result);
+    REQUIRE(solver.factorizationCount() == 1);
+    REQUIRE(solver.activeSolverType() == blend::SOLVER_SPARSE_LU);
+}
+
+TEST_CASE("Guidance-field-divergence")
+{
+    const int width = 23;
+    const int height = 17;
+
+    cv::Mat bg(height, width, CV_8UC3), fg(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width * 3; ++x) {
+            bg.ptr<uchar>(y)[x] = static_cast<uchar>((x * 31 + y * 17) % 256);
+            fg.ptr<uchar>(y)[x] = static_cast<uchar>((x * x + 7 * y * y) % 256);
+        }
+    }
+
+    cv::Mat kernelx = (cv::Mat_<float>(1, 3) << -0.5, 0, 0.5);
+    cv::Mat kernely = (cv::Mat_<float>(3, 1) << -0.5, 0, 0.5);
+
+    const blend::CloneType types[] = {
+        blend::CLONE_FOREGROUND_GRADIENTS,
+        blend::CLONE_AVERAGED_GRADIENTS,
+        blend::CLONE_MIXED_GRADIENTS
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        cv::Mat vx, vy;
+        if (types[i] == blend::CLONE_MIXED_GRADIENTS) {
+            blend::detail::computeMixedGradientVectorField(bg, fg, vx, vy);
+        } else {
+            blend::detail::computeWeightedGradientVectorField(bg, fg, vx, vy, types[i] == blend::CLONE_AVERAGED_GRADIENTS ? 0.5f : 1.f);
+        }
+
+        cv::Mat vxx, vyy;
+        cv::filter2D(vx, vxx, CV_32F, kernelx);
+        cv::filter2D(vy, vyy, CV_32F, kernely);
+        cv::Mat expected = vxx + vyy;
+
+        cv::Mat f;
+        blend::detail::computeGuidanceFieldDivergence(bg, fg, f, types[i]);
+        REQUIRE(cv::norm(f, expected, cv::NORM_INF) < 1e-4);
+    }
+}
+
+TEST_CASE("Clone-sub-region")
+{
+    cv::Mat bg(40, 50, CV_8UC3), fg(60, 70, CV_8UC3);
+    for (int y = 0; y < bg.rows; ++y)
+        for (int x = 0; x < bg.cols * 3; ++x)
+            bg.ptr<uchar>(y)[x] = static_cast<uchar>((x * 13 + y * 7) % 200 + 20);
+    for (int y = 0; y < fg.rows; ++y)
+        for (int x = 0; x < fg.cols * 3; ++x)
+            fg.ptr<uchar>(y)[x] = static_cast<uchar>((x * x + 11 * y * y) % 256);
+
+    // The overlap is a sub-region of the foreground, and the mask reaches its left and top edges:
+    // gradients there read the foreground around the overlap.
+    const cv::Rect rfg(10, 8, bg.cols, bg.rows);
+    cv::Mat mask(fg.size(), CV_8UC1);
+    mask.setTo(0);
+    mask(cv::Rect(rfg.x, rfg.y, 20, 15)).setTo(255);
+
+    cv::Mat kernelx = (cv::Mat_<float>(1, 3) << -0.5, 0, 0.5);
+    cv::Mat kernely = (cv::Mat_<float>(3, 1) << -0.5, 0, 0.5);
+
+    cv::Mat vx, vy, vxx, vyy;
+    blend::detail::computeWeightedGradientVectorField(bg, fg(rfg), vx, vy, 1.f);
+    cv::filter2D(vx, vxx, CV_32F, kernelx);
+    cv::filter2D(vy, vyy, CV_32F, kernely);
+    cv::Mat f = vxx + vyy;
+
+    cv::Mat bmask;
+    cv::threshold(mask(rfg), bmask, blend::constants::UNKNOWN, blend::constants::DIRICHLET_BD, cv::THRESH_BINARY_INV);
+    cv::rectangle(bmask, cv::Rect(0, 0, bmask.cols, bmask.rows), blend::constants::DIRICHLET_BD, 1);
+    cv::Mat bvalues;
+    bg.convertTo(bvalues, CV_32F);
+
+    cv::Mat solved, expected;
+    blend::solvePoissonEquations(f, bmask, bvalues, solved);
+    solved.convertTo(expected, CV_8U);
+
+    cv::Mat result;
+    blend::seamlessClone(bg, fg, mask, -rfg.x, -rfg.y, result, blend::CLONE_FOREGROUND_GRADIENTS);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) <= 1);
+}
+
+TEST_CASE("Clone-empty-mask")
+{
+    cv::Mat bg(30, 40, CV_8UC3), fg(20, 20, CV_8UC3);
+    bg.setTo(cv::Scalar(10, 20, 30));
+    fg.setTo(cv::Scalar(200, 100, 0));
+
+    cv::Mat mask(20, 20, CV_8UC1);
+    mask.setTo(0);
+    mask(cv::Rect(15, 15, 5, 5)).setTo(255);
+
+    // Masked pixels fall outside the background, nothing to solve.
+    cv::Mat result;
+    blend::seamlessClone(bg, fg, mask, 25, 12, result, blend::CLONE_FOREGROUND_GRADIENTS);
+    REQUIRE(cv::norm(result, bg, cv::NORM_INF) == 0);
+}
+
+TEST_CASE("Clone-batch")
+{
+    cv::Mat bg(40, 50, CV_8UC3);
+    for (int y = 0; y < bg.rows; ++y)
+        for (int x = 0; x < bg.cols * 3; ++x)
+            bg.ptr<uchar>(y)[x] = static_cast<uchar>((x * 13 + y * 7) % 200 + 20);
+
+    std::vector<cv::Mat> fgs(3);
+    for (int i = 0; i < 3; ++i) {
+        fgs[i].create(20, 25, CV_8UC3);
+        for (int y = 0; y < fgs[i].rows; ++y)
+            for (int x = 0; x < fgs[i].cols * 3; ++x)
+                fgs[i].ptr<uchar>(y)[x] = static_cast<uchar>((x * x * (i + 1) + y * 11) % 256);
+    }
+
+    cv::Mat mask(20, 25, CV_8UC1);
+    mask.setTo(0);
+    mask(cv::Rect(5, 4, 12, 10)).setTo(255);
+
+    std::vector<cv::Mat> results;
+    blend::seamlessCloneBatch(bg, fgs, mask, 10, 8, results, blend::CLONE_MIXED_GRADIENTS);
+    REQUIRE(results.size() == 3);
+
+    for (int i = 0; i < 3; ++i) {
+        cv::Mat expected;
+        blend::seamlessClone(bg, fgs[i], mask, 10, 8, expected, blend::CLONE_MIXED_GRADIENTS);
+        REQUIRE(cv::norm(results[i], expected, cv::NORM_INF) == 0);
+    }
+}
+
+TEST_CASE("Blend-band")
+{
+    cv::Mat first(192, 256, CV_8UC3), second(192, 256, CV_8UC3);
+    for (int y = 0; y < first.rows; ++y)
+        for (int x = 0; x < first.cols * 3; ++x) {
+            first.ptr<uchar>(y)[x] = static_cast<uchar>(60 + x / 6 + (x % 3) * 20);
+            second.ptr<uchar>(y)[x] = static_cast<uchar>(80 + y / 2 + (x % 3) * 30);
+        }
+
+    cv::Mat mask(192, 256, CV_8UC1);
+    mask.setTo(0);
+    mask.colRange(0, 150).setTo(255);
+
+    cv::Mat expected;
+    blend::seamlessBlend(first, second, mask, expected);
+
+    // Band covering the whole image, solved exactly.
+    cv::Mat result;
+    blend::seamlessBlendBand(first, second, mask, result, 256);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) == 0);
+
+    // Far pixels from half resolution.
+    blend::seamlessBlendBand(first, second, mask, result, 16);
+    REQUIRE(cv::norm(result, expected, cv::NORM_INF) <= 3);
+}
+
+TEST_CASE("Neumann-between-dirichlet")
+{
+    cv::Mat f(3, 3, CV_32FC1);
+    f.setTo(0);
+
+    // The Neumann pixel on top has Dirichlet pixels on both sides, and only its south neighbor to mirror.
+    cv::Mat bmask(3, 3, CV_8UC1);
+    bmask.setTo(blend::constants::DIRICHLET_BD);
+    bmask.at<uchar>(0, 1) = blend::constants::NEUMANN_BD;
+    bmask.at<uchar>(1, 1) = blend::constants::UNKNOWN;
+
+    cv::Mat bvalues(3, 3, CV_32FC1);
+    bvalues.setTo(0);
+    bvalues.at<float>(1, 0) = 2;
+    bvalues.at<float>(1, 2) = 4;
+    bvalues.at<float>(2, 1) = 6;
+
+    cv::Mat result;
+    blend::solvePoissonEquations(f, bmask, bvalues, result);
+    REQUIRE(result.at<float>(0, 1) == Approx(4.f));
+    REQUIRE(result.at<float>(1, 1) == Approx(4.f));
+
+    blend::solvePoissonEquations(f, bmask, bvalues, result, blend::SOLVER_MATRIX_FREE);
+    REQUIRE(result.at<float>(0, 1) == Approx(4.f));
+    REQUIRE(result.at<float>(1, 1) == Approx(4.f));
+}
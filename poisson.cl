@@ -4,229 +4,161 @@ __constant sampler_t sampler =
     | CLK_ADDRESS_CLAMP_TO_EDGE
     | CLK_FILTER_NEAREST;
 
-// Computes contour of binary |mask| describing a shape (pixels >= 128 are
-// assumed to be part of shape) and writes result to |boundary|.
-// and writes result to |boundary|
-__kernel void make_boundary(__read_only image2d_t mask,
-                            __write_only image2d_t boundary) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
-
-  const uint4 mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
-  const uint4 left = read_imageui(mask, sampler, (int2)(pos.x-1, pos.y));
-  const uint4 right = read_imageui(mask, sampler, (int2)(pos.x+1, pos.y));
-  const uint4 down = read_imageui(mask, sampler, (int2)(pos.x, pos.y-1));
-  const uint4 up = read_imageui(mask, sampler, (int2)(pos.x, pos.y+1));
-  //if neighboor pixel is part of the mask
-  if ((left[0] >= 128 && mid[0] < 128) ||
-      (mid[0] < 128 && right[0] >= 128) ||
-      (down[0] >= 128 && mid[0] < 128) ||
-      (mid[0] < 128 && up[0] >= 128)) {
-    write_imageui(boundary, (int2)(pos.x, pos.y), 255); // add pixel to boundary
-  } else {
-    write_imageui(boundary, (int2)(pos.x, pos.y), uint4(0));
-  }
+// Kernels launched over the active tiles of the mask run one work-group per
+// tile: the host lists the tiles as 4 ints each, the column and row of the
+// tile's origin, TILE_INTERIOR when the tile and the pixels around it are
+// all in the mask, and padding.
+#define TILE_INTERIOR 1
+
+// Returns the tile of the current work-group in |tiles|.
+int4 current_tile(__global const int* tiles) {
+  return vload4(get_group_id(0), tiles);
 }
 
-// Computes the guidance field composed of the |boundary| in destination
-// image |f| and the vector field corresponding to the |mask|'s area in |g|
-__kernel void make_guidance(__read_only image2d_t f,
-                            __read_only image2d_t g,
-                            __read_only image2d_t mask,
-                            __read_only image2d_t boundary,
-                            __write_only image2d_t guidance) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
-
-  float4 res = 0.0;
-
-  const uint4 mask_mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
-
-  // if the current pixel is in the mask, 2nd summation of the right side of the
-  //equation, we calculate the sum of all 4 vectors
-  if (mask_mid[0] >= 128) {
-    const float4 g_mid = read_imagef(g, sampler, (int2)(pos.x, pos.y));
-    const float4 g_left = read_imagef(g, sampler, (int2)(pos.x-1, pos.y));
-    const float4 g_right = read_imagef(g, sampler, (int2)(pos.x+1, pos.y));
-    const float4 g_down = read_imagef(g, sampler, (int2)(pos.x, pos.y-1));
-    const float4 g_up = read_imagef(g, sampler, (int2)(pos.x, pos.y+1));
-
-    res += float4(4.0) * g_mid - (g_left + g_right + g_up + g_down);
-  }
-
-  const uint4 bound_left = read_imageui(boundary, sampler, (int2)(pos.x-1, pos.y));
-  const uint4 bound_right = read_imageui(boundary, sampler, (int2)(pos.x+1, pos.y));
-  const uint4 bound_down = read_imageui(boundary, sampler, (int2)(pos.x, pos.y-1));
-  const uint4 bound_up = read_imageui(boundary, sampler, (int2)(pos.x, pos.y+1));
+// Returns the position of the current work-item in |tile|.
+int2 tile_position(int4 tile) {
+  return tile.xy + (int2)(get_local_id(0), get_local_id(1));
+}
 
-  // if a neighboor pixel is on the boundary, 1st part of the right side of the
-  // equation.
-  if (bound_left[0] == 255)
+// Returns the sum of the destination |f| over the neighboors of |pos| that
+// are outside of |mask|. For a pixel of the mask, these neighboors are
+// exactly its neighboors on the mask's boundary, so the boundary doesn't need
+// to be computed beforehand.
+float4 boundary_sum(__read_only image2d_t f,
+                    __read_only image2d_t mask,
+                    int2 pos) {
+  float4 res = 0.0f;
+  if (read_imageui(mask, sampler, (int2)(pos.x-1, pos.y))[0] < 128)
     res += read_imagef(f, sampler, (int2)(pos.x-1, pos.y));
-  if (bound_right[0] == 255)
+  if (read_imageui(mask, sampler, (int2)(pos.x+1, pos.y))[0] < 128)
     res += read_imagef(f, sampler, (int2)(pos.x+1, pos.y));
-  if (bound_down[0] == 255)
+  if (read_imageui(mask, sampler, (int2)(pos.x, pos.y-1))[0] < 128)
     res += read_imagef(f, sampler, (int2)(pos.x, pos.y-1));
-  if (bound_up[0] == 255)
+  if (read_imageui(mask, sampler, (int2)(pos.x, pos.y+1))[0] < 128)
     res += read_imagef(f, sampler, (int2)(pos.x, pos.y+1));
-
-  write_imagef(guidance, (int2)(pos.x, pos.y), res);
+  return res;
 }
 
-/**
- * Calculates the guidance field composed of the |boundary| in destination image |f|
- * and the vector field corresponding to the |mask|'s area in |g|. Returns its answer
- * in its output parameter |guidance|.
- * This implementation uses mixed_gradients instead of g_p - g_q, which means that
- * we pick the max between the gradient in source and in destination
- */
-__kernel void make_guidance_mixed_gradient(__read_only image2d_t f,
-                            __read_only image2d_t g,
-                            __read_only image2d_t mask,
-                            __read_only image2d_t boundary,
-                            __write_only image2d_t guidance) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
-
-  float4 res = 0.0;
+// Computes the right side of the poisson equation at |pos|, in |tile|, in
+// |guidance|: the boundary values of destination image |f| and the vector
+// field of source image |g| over the |mask|'s area, with the vectors given by
+// |method|, as GradientMethod: 0 for g_p - g_q, 1 for mixed gradients and 2
+// for their average. Returns the first iterate at |pos|, which is |f| inside
+// the mask and 0 elsewhere.
+float4 prepare_pixel(__read_only image2d_t f,
+                     __read_only image2d_t g,
+                     __read_only image2d_t mask,
+                     __write_only image2d_t guidance,
+                     int4 tile,
+                     int2 pos,
+                     int method) {
+  const bool interior = tile.z == TILE_INTERIOR;
+  if (!interior && read_imageui(mask, sampler, pos)[0] < 128) {
+    write_imagef(guidance, pos, (float4)(0.0f));
+    return 0.0f;
+  }
 
-  // Read mask and neighboors in f
-  const uint4 mask_mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
-  const float4 f_left = read_imagef(f, sampler, (int2)(pos.x-1, pos.y));
-  const float4 f_right = read_imagef(f, sampler, (int2)(pos.x+1, pos.y));
-  const float4 f_down = read_imagef(f, sampler, (int2)(pos.x, pos.y-1));
-  const float4 f_up = read_imagef(f, sampler, (int2)(pos.x, pos.y+1));
-
-  if (mask_mid[0] >= 128) { // If pixel is white in mask, mixing gradients
-    // Calculate the 4 differences between the pixel and its 4 neighboors, for both f and g
-    const float4 g_mid = read_imagef(g, sampler, (int2)(pos.x, pos.y));
-    const float4 g_left_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x-1, pos.y));
-    const float4 g_right_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x+1, pos.y));
-    const float4 g_down_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x, pos.y-1));
-    const float4 g_up_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x, pos.y+1));
-    const float4 f_mid = read_imagef(f, sampler, (int2)(pos.x, pos.y));
-    const float4 f_left_diff = f_mid - f_left;
-    const float4 f_right_diff = f_mid - f_right;
-    const float4 f_down_diff = f_mid - f_down;
-    const float4 f_up_diff = f_mid - f_up;
-
-    // For all 4 neighboors, add its value in the image (f or g) with the highest distance to mid
-    // NB: we use dot product with itself, since it gives square distance and if
-    //     square distance of a vector a is higher than another vector b's, it
-    //     that distance of a is higher than the distance of b.
-    if (dot(g_left_diff, g_left_diff) > dot(f_left_diff, f_left_diff))
-      res += g_left_diff;
+  // sum of the 4 vectors of the guidance field around the current pixel
+  const int2 dirs[4] = {(int2)(-1, 0), (int2)(1, 0), (int2)(0, -1), (int2)(0, 1)};
+  const float4 g_mid = read_imagef(g, sampler, pos);
+  const float4 f_mid = read_imagef(f, sampler, pos);
+  float4 res = 0.0f;
+  for (int d = 0; d < 4; ++d) {
+    const float4 g_diff = g_mid - read_imagef(g, sampler, pos + dirs[d]);
+    if (method == 0) {
+      res += g_diff;
+      continue;
+    }
+    const float4 f_diff = f_mid - read_imagef(f, sampler, pos + dirs[d]);
+    if (method == 1) // the difference with the highest square distance to mid
+      res += dot(g_diff, g_diff) > dot(f_diff, f_diff) ? g_diff : f_diff;
     else
-      res += f_left_diff;
-    if (dot(g_right_diff, g_right_diff) > dot(f_right_diff, f_right_diff))
-      res += g_right_diff;
-    else
-      res += f_right_diff;
-    if (dot(g_down_diff, g_down_diff) > dot(f_down_diff, f_down_diff))
-      res += g_down_diff;
-    else
-      res += f_down_diff;
-    if (dot(g_up_diff, g_up_diff) > dot(f_up_diff, f_up_diff))
-      res += g_up_diff;
-    else
-      res += f_up_diff;
+      res += 0.5f * (g_diff + f_diff);
   }
 
-  // Read neighboor's boundaries
-  const uint4 bound_left = read_imageui(boundary, sampler, (int2)(pos.x-1, pos.y));
-  const uint4 bound_right = read_imageui(boundary, sampler, (int2)(pos.x+1, pos.y));
-  const uint4 bound_down = read_imageui(boundary, sampler, (int2)(pos.x, pos.y-1));
-  const uint4 bound_up = read_imageui(boundary, sampler, (int2)(pos.x, pos.y+1));
+  if (!interior) // the pixels of interior tiles have no neighboor on the boundary
+    res += boundary_sum(f, mask, pos);
 
-  // if current pixel is next to a boundary pixel, add that boundary pixel's value
-  if (bound_left[0] == 255)
-    res += f_left;
-  if (bound_right[0] == 255)
-    res += f_right;
-  if (bound_down[0] == 255)
-    res += f_down;
-  if (bound_up[0] == 255)
-    res += f_up;
-
-  // write output to output parameter
-  write_imagef(guidance, (int2)(pos.x, pos.y), res);
+  write_imagef(guidance, pos, res);
+  return f_mid;
 }
 
 /**
- * Calculates the guidance field composed of the |boundary| in destination image |f|
- * and the vector field corresponding to the |mask|'s area in |g|. Returns its answer
- * in its output parameter |guidance|.
- * This implementation uses mixed_gradients with average instead of g_p - g_q,
- * which means that we pick the max between the gradient in source and in
- * destination
+ * Prepares the poisson equation in a single pass: computes the right side of
+ * the equation in |guidance|, made of the boundary values of destination
+ * image |f| and the vector field of source image |g| over the |mask|'s area,
+ * and the first iterate |x|, which is |f| inside the mask and 0 elsewhere.
+ * Launched over the active |tiles|: pixels outside of them are left as is.
  */
-__kernel void make_guidance_mixed_gradient_avg(__read_only image2d_t f,
-                            __read_only image2d_t g,
-                            __read_only image2d_t mask,
-                            __read_only image2d_t boundary,
-                            __write_only image2d_t guidance) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
-
-  float4 res = 0.0;
-
-  // Read mask and neighboors in f
-  const uint4 mask_mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
-  const float4 f_left = read_imagef(f, sampler, (int2)(pos.x-1, pos.y));
-  const float4 f_right = read_imagef(f, sampler, (int2)(pos.x+1, pos.y));
-  const float4 f_down = read_imagef(f, sampler, (int2)(pos.x, pos.y-1));
-  const float4 f_up = read_imagef(f, sampler, (int2)(pos.x, pos.y+1));
-
-  if (mask_mid[0] >= 128) { // If pixel is white in mask, mixing gradients
-    // Calculate the 4 differences between the pixel and its 4 neighboors, for both f and g
-    const float4 g_mid = read_imagef(g, sampler, (int2)(pos.x, pos.y));
-    const float4 g_left_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x-1, pos.y));
-    const float4 g_right_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x+1, pos.y));
-    const float4 g_down_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x, pos.y-1));
-    const float4 g_up_diff = g_mid - read_imagef(g, sampler, (int2)(pos.x, pos.y+1));
-    const float4 f_mid = read_imagef(f, sampler, (int2)(pos.x, pos.y));
-    const float4 f_left_diff = f_mid - f_left;
-    const float4 f_right_diff = f_mid - f_right;
-    const float4 f_down_diff = f_mid - f_down;
-    const float4 f_up_diff = f_mid - f_up;
-
-    // For all 4 neighboors, add its value in the image (f or g) with the highest distance to mid
-    // NB: we use dot product with itself, since it gives square distance and if
-    //     square distance of a vector a is higher than another vector b's, it
-    //     that distance of a is higher than the distance of b.
-    res += float4(0.5) * (g_left_diff + f_left_diff);
-    res += float4(0.5) * (g_right_diff + f_right_diff);
-    res += float4(0.5) * (g_down_diff + f_down_diff);
-    res += float4(0.5) * (g_up_diff + f_up_diff);
-  }
-
-  // Read neighboor's boundaries
-  const uint4 bound_left = read_imageui(boundary, sampler, (int2)(pos.x-1, pos.y));
-  const uint4 bound_right = read_imageui(boundary, sampler, (int2)(pos.x+1, pos.y));
-  const uint4 bound_down = read_imageui(boundary, sampler, (int2)(pos.x, pos.y-1));
-  const uint4 bound_up = read_imageui(boundary, sampler, (int2)(pos.x, pos.y+1));
-
-  // if current pixel is next to a boundary pixel, add that boundary pixel's value
-  if (bound_left[0] == 255)
-    res += f_left;
-  if (bound_right[0] == 255)
-    res += f_right;
-  if (bound_down[0] == 255)
-    res += f_down;
-  if (bound_up[0] == 255)
-    res += f_up;
+__kernel void prepare(__global const int* tiles,
+                      __read_only image2d_t f,
+                      __read_only image2d_t g,
+                      __read_only image2d_t mask,
+                      __write_only image2d_t guidance,
+                      __write_only image2d_t x) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  if (pos.x >= get_image_width(mask) || pos.y >= get_image_height(mask))
+    return;
+
+  write_imagef(x, pos, prepare_pixel(f, g, mask, guidance, tile, pos, 0));
+}
 
-  // write output to output parameter
-  write_imagef(guidance, (int2)(pos.x, pos.y), res);
+/**
+ * Same as prepare, using mixed gradients instead of g_p - g_q, which means
+ * that we pick the max between the gradient in source and in destination.
+ */
+__kernel void prepare_mixed_gradient(__global const int* tiles,
+                                     __read_only image2d_t f,
+                                     __read_only image2d_t g,
+                                     __read_only image2d_t mask,
+                                     __write_only image2d_t guidance,
+                                     __write_only image2d_t x) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  if (pos.x >= get_image_width(mask) || pos.y >= get_image_height(mask))
+    return;
+
+  write_imagef(x, pos, prepare_pixel(f, g, mask, guidance, tile, pos, 1));
 }
 
 /**
- * Applies the |mask| onto |image|, in order to get a patch of the image
+ * Same as prepare, using the average of the gradients in source and in
+ * destination instead of g_p - g_q.
  */
-__kernel void apply_mask(__read_only image2d_t mask,
-                         __write_only image2d_t image) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
+__kernel void prepare_mixed_gradient_avg(__global const int* tiles,
+                                         __read_only image2d_t f,
+                                         __read_only image2d_t g,
+                                         __read_only image2d_t mask,
+                                         __write_only image2d_t guidance,
+                                         __write_only image2d_t x) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  if (pos.x >= get_image_width(mask) || pos.y >= get_image_height(mask))
+    return;
+
+  write_imagef(x, pos, prepare_pixel(f, g, mask, guidance, tile, pos, 2));
+}
 
-  const uint4 mask_mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
-  if (mask_mid[0] < 128) {
-    write_imagef(image, (int2)(pos.x, pos.y), float4(0.0));
-  }
+/**
+ * Same as prepare, with the vectors given by |method| as in prepare_pixel,
+ * writing the first iterate into |x|, a buffer of float4 with a row per row
+ * of the mask, for the solvers updating their iterate in place.
+ */
+__kernel void prepare_buffer(__global const int* tiles,
+                             __read_only image2d_t f,
+                             __read_only image2d_t g,
+                             __read_only image2d_t mask,
+                             __write_only image2d_t guidance,
+                             __global float4* x,
+                             int method) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  const int width = get_image_width(mask);
+  if (pos.x >= width || pos.y >= get_image_height(mask))
+    return;
+
+  x[pos.y * width + pos.x] = prepare_pixel(f, g, mask, guidance, tile, pos, method);
 }
 
 /**
@@ -234,16 +166,23 @@ __kernel void apply_mask(__read_only image2d_t mask,
  * the poisson equation. It calculates the left side of the equation and finds
  * a new |src| to use (put in |dst|), only applied at |mask|'s region and using
  * |b| as the boundary corresponding to the right side of poisson's equation.
+ * Launched over the active |tiles|, which cover the mask and its boundary.
  */
-__kernel void jacobi_iteration(__read_only image2d_t src,
+__kernel void jacobi_iteration(__global const int* tiles,
+                            __read_only image2d_t src,
                             __read_only image2d_t guidance,
                             __read_only image2d_t mask,
                             __write_only image2d_t dst) {
-  const int2 pos = {get_global_id(0), get_global_id(1)};
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  // tiles on the right and bottom edges can go past the image
+  if (pos.x >= get_image_width(dst) || pos.y >= get_image_height(dst))
+    return;
 
   float4 res = 0.0;
 
-  const uint4 mask_mid = read_imageui(mask, sampler, (int2)(pos.x, pos.y));
+  const uint4 mask_mid = tile.z == TILE_INTERIOR ?
+      (uint4)(255) : read_imageui(mask, sampler, (int2)(pos.x, pos.y));
 
   // if part of the region targeted by the mask
   // Find f_p's next value. This is basically the equation 7 presented
@@ -263,3 +202,722 @@ __kernel void jacobi_iteration(__read_only image2d_t src,
 
   write_imagef(dst, (int2)(pos.x, pos.y), res);
 }
+
+/**
+ * Same as jacobi_iteration, for CPU devices. Each work-item updates a run of
+ * |run| pixels along a row, carrying its left and middle neighboors over from
+ * one pixel to the next, so that a thread walks memory linearly and reads 3
+ * pixels of |src| per pixel instead of 4.
+ */
+__kernel void jacobi_iteration_run(__read_only image2d_t src,
+                            __read_only image2d_t guidance,
+                            __read_only image2d_t mask,
+                            __write_only image2d_t dst,
+                            int run) {
+  const int y = get_global_id(1);
+  const int begin = get_global_id(0) * run;
+  const int end = min(begin + run, get_image_width(dst));
+
+  float4 src_left = read_imagef(src, sampler, (int2)(begin-1, y));
+  float4 src_mid = read_imagef(src, sampler, (int2)(begin, y));
+  for (int x = begin; x < end; ++x) {
+    const float4 src_right = read_imagef(src, sampler, (int2)(x+1, y));
+
+    float4 res = 0.0f;
+    const uint4 mask_mid = read_imageui(mask, sampler, (int2)(x, y));
+    if (mask_mid[0] >= 128) {
+      const float4 b_mid = read_imagef(guidance, sampler, (int2)(x, y));
+      const float4 src_down = read_imagef(src, sampler, (int2)(x, y-1));
+      const float4 src_up = read_imagef(src, sampler, (int2)(x, y+1));
+
+      res = (b_mid + src_left + src_right + src_down + src_up) / 4.0f;
+    }
+    write_imagef(dst, (int2)(x, y), res);
+
+    src_left = src_mid;
+    src_mid = src_right;
+  }
+}
+
+// Boundary conditions of the pixels in the |codes| of the *_codes kernels,
+// as kUnknownCode, kDirichletCode and kNeumannCode in poisson.hpp.
+#define CODE_UNKNOWN 0
+#define CODE_DIRICHLET 1
+#define CODE_NEUMANN 2
+
+// Lists in |nb| the neighboors that the equation of the pixel at |pos|, of
+// boundary condition |code|, reads given the boundary |codes|, and returns
+// their number, which is the diagonal coefficient of the equation. A
+// neighboor outside of the image is dropped for an unknown pixel. For a
+// Neumann pixel, it is replaced by the opposite neighboor, and so is a
+// Dirichlet one; if the opposite one isn't available either, both are
+// dropped. Same as stencil in poisson_serial.cpp.
+int stencil(__read_only image2d_t codes, int2 pos, uint code, int2 nb[4]) {
+  const int2 size = get_image_dim(codes);
+  // left, right, up and down, so that the opposite of d is d ^ 1
+  const int2 dirs[4] = {(int2)(-1, 0), (int2)(1, 0), (int2)(0, -1), (int2)(0, 1)};
+  bool available[4];
+  for (int d = 0; d < 4; ++d) {
+    const int2 q = pos + dirs[d];
+    available[d] = all(q >= (int2)(0)) && all(q < size) &&
+        !(code == CODE_NEUMANN && read_imageui(codes, sampler, q)[0] == CODE_DIRICHLET);
+  }
+  int count = 0;
+  for (int d = 0; d < 4; ++d) {
+    if (available[d])
+      nb[count++] = pos + dirs[d];
+    else if (code == CODE_NEUMANN && available[d ^ 1])
+      nb[count++] = pos + dirs[d ^ 1];
+  }
+  return count;
+}
+
+// Prepares the pixel of the current work-item for the *_codes kernels, with
+// the vectors of the guidance field given by |method|, as GradientMethod: 0
+// for g_p - g_q, 1 for mixed gradients and 2 for their average.
+void prepare_codes_pixel(__global const int* tiles,
+                         __read_only image2d_t f,
+                         __read_only image2d_t g,
+                         __read_only image2d_t codes,
+                         __write_only image2d_t guidance,
+                         __write_only image2d_t x,
+                         int method) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  if (pos.x >= get_image_width(codes) || pos.y >= get_image_height(codes))
+    return;
+
+  // the destination is the first iterate, and Dirichlet pixels keep it
+  const float4 f_mid = read_imagef(f, sampler, pos);
+  write_imagef(x, pos, f_mid);
+
+  const uint code = read_imageui(codes, sampler, pos)[0];
+  if (code == CODE_DIRICHLET) {
+    write_imagef(guidance, pos, (float4)(0.0f));
+    return;
+  }
+
+  int2 nb[4];
+  const int count = stencil(codes, pos, code, nb);
+  const float4 g_mid = read_imagef(g, sampler, pos);
+  float4 res = 0.0f;
+  for (int k = 0; k < count; ++k) {
+    const float4 g_diff = g_mid - read_imagef(g, sampler, nb[k]);
+    const float4 f_diff = f_mid - read_imagef(f, sampler, nb[k]);
+    if (method == 0)
+      res += g_diff;
+    else if (method == 1)
+      res += dot(g_diff, g_diff) > dot(f_diff, f_diff) ? g_diff : f_diff;
+    else
+      res += 0.5f * (g_diff + f_diff);
+  }
+  write_imagef(guidance, pos, res);
+}
+
+/**
+ * Same as prepare, with the per-pixel boundary conditions |codes| instead of
+ * a mask. The first iterate |x| is |f| on every pixel: Dirichlet pixels keep
+ * their value in it, where the equations of their neighboors read it, so the
+ * |guidance| has no boundary term.
+ */
+__kernel void prepare_codes(__global const int* tiles,
+                            __read_only image2d_t f,
+                            __read_only image2d_t g,
+                            __read_only image2d_t codes,
+                            __write_only image2d_t guidance,
+                            __write_only image2d_t x) {
+  prepare_codes_pixel(tiles, f, g, codes, guidance, x, 0);
+}
+
+/**
+ * Same as prepare_codes, with mixed gradients.
+ */
+__kernel void prepare_codes_mixed_gradient(__global const int* tiles,
+                                           __read_only image2d_t f,
+                                           __read_only image2d_t g,
+                                           __read_only image2d_t codes,
+                                           __write_only image2d_t guidance,
+                                           __write_only image2d_t x) {
+  prepare_codes_pixel(tiles, f, g, codes, guidance, x, 1);
+}
+
+/**
+ * Same as prepare_codes, with the average of the gradients.
+ */
+__kernel void prepare_codes_mixed_gradient_avg(__global const int* tiles,
+                                               __read_only image2d_t f,
+                                               __read_only image2d_t g,
+                                               __read_only image2d_t codes,
+                                               __write_only image2d_t guidance,
+                                               __write_only image2d_t x) {
+  prepare_codes_pixel(tiles, f, g, codes, guidance, x, 2);
+}
+
+/**
+ * Same as jacobi_iteration, with the per-pixel boundary conditions |codes|
+ * and the |guidance| of prepare_codes. Dirichlet pixels are copied from
+ * |src|, so that both iterates keep their value. Interior tiles only have
+ * unknown pixels, away from the image border.
+ */
+__kernel void jacobi_iteration_codes(__global const int* tiles,
+                                     __read_only image2d_t src,
+                                     __read_only image2d_t guidance,
+                                     __read_only image2d_t codes,
+                                     __write_only image2d_t dst) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  // tiles on the right and bottom edges can go past the image
+  if (pos.x >= get_image_width(dst) || pos.y >= get_image_height(dst))
+    return;
+
+  float4 res;
+  if (tile.z == TILE_INTERIOR) {
+    const float4 b_mid = read_imagef(guidance, sampler, pos);
+    const float4 src_left = read_imagef(src, sampler, (int2)(pos.x-1, pos.y));
+    const float4 src_right = read_imagef(src, sampler, (int2)(pos.x+1, pos.y));
+    const float4 src_down = read_imagef(src, sampler, (int2)(pos.x, pos.y-1));
+    const float4 src_up = read_imagef(src, sampler, (int2)(pos.x, pos.y+1));
+    res = (b_mid + src_left + src_right + src_down + src_up) / 4.0f;
+  } else {
+    const uint code = read_imageui(codes, sampler, pos)[0];
+    int2 nb[4];
+    const int count = code == CODE_DIRICHLET ? 0 : stencil(codes, pos, code, nb);
+    if (count == 0) { // Dirichlet, or without any neighboor to read
+      res = read_imagef(src, sampler, pos);
+    } else {
+      res = read_imagef(guidance, sampler, pos);
+      for (int k = 0; k < count; ++k)
+        res += read_imagef(src, sampler, nb[k]);
+      res /= (float)count;
+    }
+  }
+
+  write_imagef(dst, pos, res);
+}
+
+/**
+ * Copies the active |tiles| of the |image| into |x|, a buffer of float4 with
+ * a row per row of the image, for the solvers updating their iterate in
+ * place.
+ */
+__kernel void image_to_buffer(__global const int* tiles,
+                              __read_only image2d_t image,
+                              __global float4* x) {
+  const int2 pos = tile_position(current_tile(tiles));
+  const int width = get_image_width(image);
+  if (pos.x >= width || pos.y >= get_image_height(image))
+    return;
+
+  x[pos.y * width + pos.x] = read_imagef(image, sampler, pos);
+}
+
+/**
+ * Copies the active |tiles| of the buffer |x| back into |image|. Inverse of
+ * image_to_buffer.
+ */
+__kernel void buffer_to_image(__global const int* tiles,
+                              __global const float4* x,
+                              __write_only image2d_t image) {
+  const int2 pos = tile_position(current_tile(tiles));
+  const int width = get_image_width(image);
+  if (pos.x >= width || pos.y >= get_image_height(image))
+    return;
+
+  write_imagef(image, pos, x[pos.y * width + pos.x]);
+}
+
+/**
+ * Half of an iteration of red-black successive over-relaxation, updating the
+ * iterate |x| in place. Only the pixels of the |mask| with (x + y) % 2 ==
+ * |parity| are updated: their 4 neighboors all have the other parity, so
+ * the half-sweep has no race. Each one moves from its current value towards
+ * its Jacobi update by a factor |omega|, in ]0, 2[.
+ */
+__kernel void sor_half_sweep(__global const int* tiles,
+                             __global float4* x,
+                             __read_only image2d_t guidance,
+                             __read_only image2d_t mask,
+                             int parity,
+                             float omega) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  const int width = get_image_width(mask);
+  const int height = get_image_height(mask);
+  if (pos.x >= width || pos.y >= height || (pos.x + pos.y) % 2 != parity)
+    return;
+  if (tile.z != TILE_INTERIOR && read_imageui(mask, sampler, pos)[0] < 128)
+    return; // outside of the mask, x stays 0
+
+  // neighboors are clamped to the edges, like the sampler does for images
+  const int i = pos.y * width + pos.x;
+  const float4 x_left = x[pos.y * width + max(pos.x-1, 0)];
+  const float4 x_right = x[pos.y * width + min(pos.x+1, width-1)];
+  const float4 x_down = x[max(pos.y-1, 0) * width + pos.x];
+  const float4 x_up = x[min(pos.y+1, height-1) * width + pos.x];
+  const float4 b_mid = read_imagef(guidance, sampler, pos);
+
+  const float4 jacobi = (b_mid + x_left + x_right + x_down + x_up) / 4.0f;
+  x[i] += omega * (jacobi - x[i]);
+}
+
+// Multigrid solver. Every level of the pyramid is a set of buffers with a row
+// per row of the level: the iterate |x| and the right side |b|, both float4,
+// and the operator |a| of the level, a 3x3 stencil per pixel stored as 9
+// planes of floats, MG_CENTER being the diagonal. A pixel is an unknown of
+// the level when its diagonal is positive, otherwise its x stays 0.
+//
+// Each level halves the axes of the one below that are longer than 2 pixels,
+// and keeps the others: its |ratio| is 2 along the halved axes and 1 along
+// the others. Coarse pixel (i, j) lies on fine pixel (ratio.x i, ratio.y j),
+// so a halved axis of w pixels has w/2+1 coarse pixels, and elongated frames
+// keep being coarsened along their long axis. The coarse operators are built by
+// Galerkin projection from the one below, with bilinear interpolation, rather
+// than by rediscretizing the mask: a mask that doesn't line up with the
+// coarse grid then still gives a coarse correction that only reduces the
+// error.
+#define MG_CENTER 4
+
+// Returns the bilinear weight of a fine pixel at |d| fine pixels of a coarse
+// pixel, along an axis of |ratio| 1 or 2.
+float mg_weight(int d, int ratio) {
+  return max(0.0f, 1.0f - (float)abs(d) / ratio);
+}
+
+// Returns the sum of the off-diagonal terms of the stencil of |pos| in |a|
+// applied to |x|, on a |width| x |height| level.
+float4 mg_off_diagonal(__global const float4* x,
+                       __global const float* a,
+                       int width, int height, int2 pos) {
+  const int n = width * height;
+  const int i = pos.y * width + pos.x;
+  float4 res = 0.0f;
+  for (int k = 0; k < 9; ++k) {
+    const int2 d = {k % 3 - 1, k / 3 - 1};
+    const int2 nb = pos + d;
+    const float coef = a[k * n + i];
+    if (k != MG_CENTER && coef != 0.0f)
+      res += coef * x[nb.y * width + nb.x];
+  }
+  return res;
+}
+
+// Relaxes the pixel |pos| of a level: Gauss-Seidel update of x.
+void mg_relax(__global float4* x,
+              __global const float4* b,
+              __global const float* a,
+              int width, int height, int2 pos) {
+  const int i = pos.y * width + pos.x;
+  const float diag = a[MG_CENTER * width * height + i];
+  if (diag > 0.0f)
+    x[i] = (b[i] - mg_off_diagonal(x, a, width, height, pos)) / diag;
+}
+
+/**
+ * Builds the operator |a| of the finest level from the 8-bit |mask| image:
+ * the 5-point laplacian over the pixels of the mask, with the neighboors
+ * past the edges of the image clamped like the sampler does for the other
+ * solvers.
+ */
+__kernel void mg_stencil(__read_only image2d_t mask,
+                         __global float* a) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+  const int width = get_image_width(mask);
+  const int height = get_image_height(mask);
+  const int n = width * height;
+  const int i = pos.y * width + pos.x;
+  const bool inside = read_imageui(mask, sampler, pos)[0] >= 128;
+
+  float diag = inside ? 4.0f : 0.0f;
+  for (int k = 0; k < 9; ++k) {
+    const int2 d = {k % 3 - 1, k / 3 - 1};
+    const int2 nb = pos + d;
+    float coef = 0.0f;
+    if (inside && abs(d.x) + abs(d.y) == 1) {
+      if (nb.x < 0 || nb.x >= width || nb.y < 0 || nb.y >= height)
+        diag -= 1.0f; // clamped onto the pixel itself
+      else if (read_imageui(mask, sampler, nb)[0] >= 128)
+        coef = -1.0f;
+    }
+    a[k * n + i] = coef;
+  }
+  a[MG_CENTER * n + i] = diag;
+}
+
+/**
+ * Builds the operator |coarse_a| of the next level, of ratio (|ratio_x|,
+ * |ratio_y|), by Galerkin projection of the operator |a| of a |width| x
+ * |height| level: each coarse stencil is the restriction of the fine stencils
+ * of the 3x3 pixels around its fine position, applied to the bilinear
+ * interpolation of its coarse neighboors.
+ */
+__kernel void mg_galerkin(__global const float* a,
+                          int width,
+                          int height,
+                          int ratio_x,
+                          int ratio_y,
+                          __global float* coarse_a) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+  const int2 ratio = {ratio_x, ratio_y};
+  const int coarse_n = get_global_size(0) * get_global_size(1);
+  const int n = width * height;
+
+  float res[9] = {0.0f};
+  for (int fy = -1; fy <= 1; ++fy) {
+    for (int fx = -1; fx <= 1; ++fx) {
+      const int2 fine = ratio * pos + (int2)(fx, fy);
+      const float p = mg_weight(fx, ratio.x) * mg_weight(fy, ratio.y);
+      if (p == 0.0f || fine.x < 0 || fine.x >= width || fine.y < 0 || fine.y >= height)
+        continue;
+      for (int d = 0; d < 9; ++d) {
+        const float coef = a[d * n + fine.y * width + fine.x];
+        if (coef == 0.0f)
+          continue;
+        // fine neighboor, relative to the fine position of |pos|
+        const int2 r = (int2)(fx, fy) + (int2)(d % 3 - 1, d / 3 - 1);
+        for (int k = 0; k < 9; ++k) {
+          const int2 rk = r - ratio * (int2)(k % 3 - 1, k / 3 - 1);
+          if (abs(rk.x) <= 1 && abs(rk.y) <= 1)
+            res[k] += p * coef * mg_weight(rk.x, ratio.x) * mg_weight(rk.y, ratio.y);
+        }
+      }
+    }
+  }
+  for (int k = 0; k < 9; ++k)
+    coarse_a[k * coarse_n + pos.y * get_global_size(0) + pos.x] = res[k];
+}
+
+/**
+ * One color of a sweep of 4-color Gauss-Seidel on a level, updating in place
+ * the pixels with (x % 2) + 2 * (y % 2) == |color|. Their 3x3 neighboors all
+ * have other colors, so the update has no race.
+ */
+__kernel void mg_smooth(__global float4* x,
+                        __global const float4* b,
+                        __global const float* a,
+                        int width,
+                        int height,
+                        int color) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+  if ((pos.x % 2) + 2 * (pos.y % 2) != color)
+    return;
+
+  mg_relax(x, b, a, width, height, pos);
+}
+
+/**
+ * Computes the residual b - ax of a |width| x |height| level and restricts
+ * it into the right side |coarse_b| of the next level, of ratio (|ratio_x|,
+ * |ratio_y|), with the transpose of the bilinear interpolation. Clears the
+ * iterate |coarse_x| of the next level, whose correction starts from 0.
+ */
+__kernel void mg_restrict_residual(__global const float4* x,
+                                   __global const float4* b,
+                                   __global const float* a,
+                                   int width,
+                                   int height,
+                                   int ratio_x,
+                                   int ratio_y,
+                                   __global float4* coarse_x,
+                                   __global float4* coarse_b) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+  const int2 ratio = {ratio_x, ratio_y};
+  const int n = width * height;
+
+  float4 res = 0.0f;
+  for (int fy = -1; fy <= 1; ++fy) {
+    for (int fx = -1; fx <= 1; ++fx) {
+      const int2 fine = ratio * pos + (int2)(fx, fy);
+      const float p = mg_weight(fx, ratio.x) * mg_weight(fy, ratio.y);
+      if (p == 0.0f || fine.x < 0 || fine.x >= width || fine.y < 0 || fine.y >= height)
+        continue;
+      const int i = fine.y * width + fine.x;
+      const float diag = a[MG_CENTER * n + i];
+      if (diag > 0.0f) {
+        const float4 r = b[i] - diag * x[i] -
+                         mg_off_diagonal(x, a, width, height, fine);
+        res += p * r;
+      }
+    }
+  }
+  const int coarse_i = pos.y * get_global_size(0) + pos.x;
+  coarse_x[coarse_i] = 0.0f;
+  coarse_b[coarse_i] = res;
+}
+
+/**
+ * Adds to the unknowns of a level the bilinear interpolation of the
+ * correction |coarse_x| of the next level, |coarse_width| pixels wide and of
+ * ratio (|ratio_x|, |ratio_y|).
+ */
+__kernel void mg_prolong(__global const float4* coarse_x,
+                         int coarse_width,
+                         int ratio_x,
+                         int ratio_y,
+                         __global float4* x,
+                         __global const float* a) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+  const int2 ratio = {ratio_x, ratio_y};
+  const int width = get_global_size(0);
+  const int i = pos.y * width + pos.x;
+  if (a[MG_CENTER * width * get_global_size(1) + i] <= 0.0f)
+    return;
+
+  // the 1, 2 or 4 coarse pixels around |pos|
+  const int2 c0 = pos / ratio;
+  const int2 c1 = (pos + ratio - 1) / ratio;
+  const float4 res = coarse_x[c0.y * coarse_width + c0.x]
+                   + coarse_x[c0.y * coarse_width + c1.x]
+                   + coarse_x[c1.y * coarse_width + c0.x]
+                   + coarse_x[c1.y * coarse_width + c1.x];
+  x[i] += res / 4.0f;
+}
+
+/**
+ * Solves the coarsest level by |sweeps| sweeps of 4-color Gauss-Seidel within
+ * a single work-group, which synchronizes between colors. The level is a few
+ * pixels wide, so that the sweeps reach the exact solution.
+ */
+__kernel void mg_coarse_solve(__global float4* x,
+                              __global const float4* b,
+                              __global const float* a,
+                              int width,
+                              int height,
+                              int sweeps) {
+  const int n = width * height;
+  for (int s = 0; s < 4 * sweeps; ++s) {
+    for (int i = get_local_id(0); i < n; i += get_local_size(0)) {
+      const int2 pos = {i % width, i / width};
+      if ((pos.x % 2) + 2 * (pos.y % 2) == s % 4)
+        mg_relax(x, b, a, width, height, pos);
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+  }
+}
+
+// Conjugate gradient solver. The vectors are buffers of float4 with a row per
+// row of the image, 0 outside of the mask, and the 3 color channels are
+// solved at once: the scalars of the method are float4 too. Dot products are
+// reduced in two stages, a partial sum per tile, then a single work-group
+// summing the partials into a slot of the |scalars| buffer, so that the
+// scalars never leave the device.
+#define CG_GROUP_SIZE 256 // work-items of a tile, and of the final reduction
+#define CG_PQ 2 // slot of p.q in |scalars|, after the 2 slots of r.z
+
+// Returns the poisson operator applied to |x| at |pos|: the left side of the
+// equation solved by jacobi_iteration, with the same clamped neighboors.
+float4 cg_stencil(__global const float4* x, int width, int height, int2 pos) {
+  const float4 x_left = x[pos.y * width + max(pos.x-1, 0)];
+  const float4 x_right = x[pos.y * width + min(pos.x+1, width-1)];
+  const float4 x_down = x[max(pos.y-1, 0) * width + pos.x];
+  const float4 x_up = x[min(pos.y+1, height-1) * width + pos.x];
+  return 4.0f * x[pos.y * width + pos.x] - (x_left + x_right + x_down + x_up);
+}
+
+// Returns the diagonal of the operator at |pos|, the Jacobi preconditioner:
+// 4, minus the neighboors clamped onto |pos| itself at the edges.
+float cg_diagonal(int width, int height, int2 pos) {
+  return 4.0f - (pos.x == 0) - (pos.x == width-1)
+              - (pos.y == 0) - (pos.y == height-1);
+}
+
+// Returns |a| / |b|, with 0 for the channels where |b| is 0.
+float4 cg_ratio(float4 a, float4 b) {
+  return select((float4)(0.0f), a / b, b != 0.0f);
+}
+
+// Sums |value| over the work-group, in |scratch|, and writes the sum to
+// |partial| at the index of the group. Must be reached by every work-item.
+void cg_reduce_group(float4 value, __local float4* scratch,
+                     __global float4* partial) {
+  const int lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+  scratch[lid] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (int s = CG_GROUP_SIZE / 2; s > 0; s /= 2) {
+    if (lid < s)
+      scratch[lid] += scratch[lid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0)
+    partial[get_group_id(0)] = scratch[0];
+}
+
+// Returns true if |pos| is in the image and in the mask.
+bool cg_active(int4 tile, int2 pos, __read_only image2d_t mask) {
+  if (pos.x >= get_image_width(mask) || pos.y >= get_image_height(mask))
+    return false;
+  return tile.z == TILE_INTERIOR || read_imageui(mask, sampler, pos)[0] >= 128;
+}
+
+/**
+ * Starts the method from the iterate |x|: computes the residual |r| of the
+ * equation with right side |guidance|, the preconditioned residual |z| and
+ * the first direction |p|, and the partial sums of r.z per tile.
+ */
+__kernel void cg_init(__global const int* tiles,
+                      __global const float4* x,
+                      __read_only image2d_t guidance,
+                      __read_only image2d_t mask,
+                      __global float4* r,
+                      __global float4* z,
+                      __global float4* p,
+                      __global float4* partial) {
+  __local float4 scratch[CG_GROUP_SIZE];
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  const int width = get_image_width(mask);
+  const int height = get_image_height(mask);
+
+  float4 rz = 0.0f;
+  if (cg_active(tile, pos, mask)) {
+    const int i = pos.y * width + pos.x;
+    const float4 r_mid = read_imagef(guidance, sampler, pos) -
+                         cg_stencil(x, width, height, pos);
+    const float4 z_mid = r_mid / cg_diagonal(width, height, pos);
+    r[i] = r_mid;
+    z[i] = z_mid;
+    p[i] = z_mid;
+    rz = r_mid * z_mid;
+  }
+  cg_reduce_group(rz, scratch, partial);
+}
+
+/**
+ * Computes q = Ap over the active |tiles|, and the partial sums of p.q per
+ * tile.
+ */
+__kernel void cg_apply(__global const int* tiles,
+                       __global const float4* p,
+                       __read_only image2d_t mask,
+                       __global float4* q,
+                       __global float4* partial) {
+  __local float4 scratch[CG_GROUP_SIZE];
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  const int width = get_image_width(mask);
+  const int height = get_image_height(mask);
+
+  float4 pq = 0.0f;
+  if (cg_active(tile, pos, mask)) {
+    const int i = pos.y * width + pos.x;
+    const float4 q_mid = cg_stencil(p, width, height, pos);
+    q[i] = q_mid;
+    pq = p[i] * q_mid;
+  }
+  cg_reduce_group(pq, scratch, partial);
+}
+
+/**
+ * Sums the |n| partial sums of |partial| into |scalars|[|slot|]. Launched as
+ * a single work-group.
+ */
+__kernel void cg_reduce(__global const float4* partial,
+                        int n,
+                        __global float4* scalars,
+                        int slot) {
+  __local float4 scratch[CG_GROUP_SIZE];
+  float4 sum = 0.0f;
+  for (int i = get_local_id(0); i < n; i += CG_GROUP_SIZE)
+    sum += partial[i];
+  cg_reduce_group(sum, scratch, scalars + slot);
+}
+
+/**
+ * Steps the iterate |x| and the residual |r| along the direction |p|, with
+ * the step size r.z / p.q read from |scalars|, r.z in slot |rz|. Updates the
+ * preconditioned residual |z| and computes the partial sums of the new r.z
+ * per tile.
+ */
+__kernel void cg_update(__global const int* tiles,
+                        __global const float4* scalars,
+                        int rz,
+                        __read_only image2d_t mask,
+                        __global const float4* p,
+                        __global const float4* q,
+                        __global float4* x,
+                        __global float4* r,
+                        __global float4* z,
+                        __global float4* partial) {
+  __local float4 scratch[CG_GROUP_SIZE];
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  const int width = get_image_width(mask);
+  const int height = get_image_height(mask);
+
+  float4 rz_new = 0.0f;
+  if (cg_active(tile, pos, mask)) {
+    const int i = pos.y * width + pos.x;
+    const float4 alpha = cg_ratio(scalars[rz], scalars[CG_PQ]);
+    x[i] += alpha * p[i];
+    const float4 r_mid = r[i] - alpha * q[i];
+    const float4 z_mid = r_mid / cg_diagonal(width, height, pos);
+    r[i] = r_mid;
+    z[i] = z_mid;
+    rz_new = r_mid * z_mid;
+  }
+  cg_reduce_group(rz_new, scratch, partial);
+}
+
+/**
+ * Computes the next direction p = z + beta p, where beta is the ratio of the
+ * new r.z in slot |rz_new| of |scalars| to the previous one in slot |rz|.
+ */
+__kernel void cg_direction(__global const int* tiles,
+                           __global const float4* scalars,
+                           int rz,
+                           int rz_new,
+                           __read_only image2d_t mask,
+                           __global const float4* z,
+                           __global float4* p) {
+  const int4 tile = current_tile(tiles);
+  const int2 pos = tile_position(tile);
+  if (!cg_active(tile, pos, mask))
+    return;
+
+  const int i = pos.y * get_image_width(mask) + pos.x;
+  p[i] = z[i] + cg_ratio(scalars[rz_new], scalars[rz]) * p[i];
+}
+
+/**
+ * Expands the packed |bits| of a mask, 1 bit per pixel and |pitch| bytes per
+ * row, lowest bit leftmost, to the 8-bit |mask| image (255 where set, 0
+ * elsewhere).
+ */
+__kernel void load_mask_bits(__global const uchar* bits,
+                             int pitch,
+                             __write_only image2d_t mask) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+
+  const uchar byte = bits[pos.y * pitch + pos.x / 8];
+  const uint value = ((byte >> (pos.x % 8)) & 1) ? 255 : 0;
+  write_imageui(mask, pos, (uint4)(value));
+}
+
+/**
+ * Converts the 8-bit BGR |frame|, 3 bytes per pixel and |pitch| bytes per
+ * row, to the float |image|.
+ */
+__kernel void load_bgr(__global const uchar* frame,
+                       int pitch,
+                       __write_only image2d_t image) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+
+  const float3 bgr = convert_float3(vload3(pos.x, frame + pos.y * pitch));
+  write_imagef(image, pos, (float4)(bgr, 0.0f));
+}
+
+/**
+ * Saturates the float |image| back to 8 bits and writes it into the BGR
+ * |frame| where |mask| is set, leaving the other pixels of |frame| untouched.
+ */
+__kernel void store_bgr(__read_only image2d_t image,
+                        __read_only image2d_t mask,
+                        __global uchar* frame,
+                        int pitch) {
+  const int2 pos = {get_global_id(0), get_global_id(1)};
+
+  const uint4 mask_mid = read_imageui(mask, sampler, pos);
+  if (mask_mid[0] >= 128) {
+    const float4 res = read_imagef(image, sampler, pos);
+    vstore3(convert_uchar3_sat_rte(res.xyz), pos.x, frame + pos.y * pitch);
+  }
+}
@@ -1,3 +1,25 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 enum class GradientMethod {BASE, MAX_MIXING, AVG_MIXING};
+
+// Iterative method solving the poisson equation.
+enum class SolverMethod {JACOBI, SOR, MULTIGRID, CG};
+
+const size_t kNIter = 10000; // iterations of the Jacobi solvers
+
+// Boundary condition of a pixel, in the codes of the *_codes functions, as
+// blend::constants of poisson-image-editing. Unknown pixels are solved for,
+// Dirichlet pixels keep their value in the iterate, and Neumann pixels are
+// solved for with a zero derivative across the image border and their
+// Dirichlet neighboors. The codes carry no Neumann value: the *_codes
+// functions take the bv of blend::buildEquation to be 0 at Neumann pixels,
+// so its 2*bv(p) term is dropped. That holds for the codes of
+// make_boundary_codes, as for those of blend::seamlessBlend, whose Neumann
+// pixels are the mask's pixels on the image border; the serial and tbb
+// *_codes functions assert that their Neumann pixels are there.
+const uint8_t kUnknownCode = 0;
+const uint8_t kDirichletCode = 1;
+const uint8_t kNeumannCode = 2;
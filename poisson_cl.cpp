@@ -0,0 +1,765 @@
+#include "poisson_cl.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "poisson_serial.hpp"
+
+const size_t kTileSize = 16; // side of the tiles launched as one work-group each
+const cl_int kTileInterior = 1; // TILE_INTERIOR in poisson.cl
+const size_t kMgSmoothSweeps = 2; // smoothing sweeps before and after each coarse correction
+const size_t kMgCoarsestExtent = 3; // max width and height of the coarsest multigrid level
+const size_t kMgCoarseGroupSize = 16; // work-items solving the coarsest level, one per pixel
+const size_t kMgCoarseSweeps = 64; // sweeps solving the coarsest level, exact at 3x3 pixels
+const size_t kCgCheckInterval = 16; // iterations between convergence checks
+const float kCgTolerance = 1e-3f; // residual reduction stopping conjugate gradient
+const size_t kCgGroupSize = kTileSize * kTileSize; // CG_GROUP_SIZE in poisson.cl
+const size_t kCgPq = 2; // CG_PQ in poisson.cl
+const size_t kCpuJacobiRun = 64; // pixels updated by a jacobi work-item on CPUs
+
+/**
+ * Finds the full path of |filename| in the working directory.
+ */
+boost::filesystem::path find_file(const std::string& filename) {
+  boost::filesystem::path path(__FILE__);
+  path.remove_filename();
+  path.append(filename);
+  return path;
+}
+
+/**
+ * Lists the |size| x |size| tiles of |image| that kernels need to run on:
+ * those which have an |active| pixel or touch one. Each tile is 4 ints, the
+ * column and row of its origin, kTileInterior when the tile and the pixels
+ * around it are all |plain| (0 otherwise), and padding.
+ */
+template <class Active, class Plain>
+std::vector<cl_int> make_tiles(gil::mat_cview<uint8_t> image, size_t size,
+                               Active active, Plain plain) {
+  std::vector<cl_int> tiles;
+  for (size_t i = 0; i < image.rows(); i += size) {
+    for (size_t j = 0; j < image.cols(); j += size) {
+      // look at the tile and the pixels around it
+      size_t row_begin = i == 0 ? 0 : i - 1;
+      size_t row_end = std::min(i + size + 1, image.rows());
+      size_t col_begin = j == 0 ? 0 : j - 1;
+      size_t col_end = std::min(j + size + 1, image.cols());
+      size_t count = 0;
+      size_t plain_count = 0;
+      for (size_t k = row_begin; k < row_end; ++k) {
+        const uint8_t* image_it = image.row_begin(k) + col_begin;
+        for (size_t l = col_begin; l < col_end; ++l, ++image_it) {
+          count += active(*image_it);
+          plain_count += plain(*image_it);
+        }
+      }
+      if (count == 0) {
+        continue;
+      }
+      bool interior = i > 0 && j > 0 &&
+          i + size < image.rows() && j + size < image.cols() &&
+          plain_count == (row_end - row_begin) * (col_end - col_begin);
+      tiles.insert(tiles.end(), {cl_int(j), cl_int(i),
+                                 interior ? kTileInterior : 0, 0});
+    }
+  }
+  return tiles;
+}
+
+/**
+ * Lists the tiles of |mask|, so that every pixel of the mask and of its
+ * boundary is in a listed tile, the interior ones being all in the mask.
+ */
+std::vector<cl_int> make_tiles(gil::mat_cview<uint8_t> mask, size_t size) {
+  auto in_mask = [](uint8_t m) { return m >= 128; };
+  return make_tiles(mask, size, in_mask, in_mask);
+}
+
+/**
+ * Lists the tiles of the boundary |codes| which have pixels solved for, the
+ * interior ones having unknown pixels only.
+ */
+std::vector<cl_int> make_code_tiles(gil::mat_cview<uint8_t> codes, size_t size) {
+  return make_tiles(codes, size,
+                    [](uint8_t c) { return c != kDirichletCode; },
+                    [](uint8_t c) { return c == kUnknownCode; });
+}
+
+/**
+ * Packs |mask| to one bit per pixel, set where the pixel is part of the mask
+ * (>= 128). Each row starts on a new byte, the lowest bit being the leftmost
+ * pixel.
+ */
+std::vector<uint8_t> pack_mask(gil::mat_cview<uint8_t> mask) {
+  size_t pitch = (mask.cols() + 7) / 8;
+  std::vector<uint8_t> bits(pitch * mask.rows(), 0);
+  for (size_t i = 0; i < mask.rows(); ++i) {
+    const uint8_t* mask_it = mask.row_begin(i);
+    uint8_t* bits_it = bits.data() + i * pitch;
+    for (size_t j = 0; j < mask.cols(); ++j, ++mask_it) {
+      if (*mask_it >= 128) {
+        bits_it[j / 8] |= uint8_t(1 << (j % 8));
+      }
+    }
+  }
+  return bits;
+}
+
+poisson_blending_cl::poisson_blending_cl(cl::device device, bool profiling)
+    : device_(device),
+      ctx_(device_) {
+  // Kernels run on queue_. Transfers of the pipelined jobs run on their own
+  // queues, so that they overlap the kernels of the other jobs.
+  auto make_queue = [&]() {
+    if (profiling) {
+      return cl::command_queue(ctx_, device_, {cl::queue_property::kProfiling});
+    }
+    return cl::command_queue(ctx_, device_);
+  };
+  queue_ = make_queue();
+  upload_queue_ = make_queue();
+  readback_queue_ = make_queue();
+
+  // read and load the OpenCL program from its file
+  boost::iostreams::mapped_file_source poisson_source(find_file("poisson.cl"));
+  program_ = cl::program(ctx_, poisson_source.data());
+  try {
+    program_.build();
+  } catch (...) {
+    std::cout << program_.get_build_info<cl::program::BuildLog>(device_);
+    return;
+  }
+
+  prepare_ = cl::kernel(program_, "prepare");
+  prepare_mixed_gradient_ = cl::kernel(program_, "prepare_mixed_gradient");
+  prepare_mixed_gradient_avg_ = cl::kernel(program_, "prepare_mixed_gradient_avg");
+  prepare_buffer_ = cl::kernel(program_, "prepare_buffer");
+  // CPU runtimes run a work-group per thread and gain nothing from 2d
+  // groups: there, each work-item updates a run along a row instead.
+  if (device_.type() == CL_DEVICE_TYPE_CPU) {
+    jacobi_iteration_ = cl::kernel(program_, "jacobi_iteration_run");
+    jacobi_run_ = kCpuJacobiRun;
+  } else {
+    jacobi_iteration_ = cl::kernel(program_, "jacobi_iteration");
+  }
+  prepare_codes_ = cl::kernel(program_, "prepare_codes");
+  prepare_codes_mixed_gradient_ = cl::kernel(program_, "prepare_codes_mixed_gradient");
+  prepare_codes_mixed_gradient_avg_ = cl::kernel(program_, "prepare_codes_mixed_gradient_avg");
+  jacobi_iteration_codes_ = cl::kernel(program_, "jacobi_iteration_codes");
+  image_to_buffer_ = cl::kernel(program_, "image_to_buffer");
+  buffer_to_image_ = cl::kernel(program_, "buffer_to_image");
+  sor_half_sweep_ = cl::kernel(program_, "sor_half_sweep");
+  mg_stencil_ = cl::kernel(program_, "mg_stencil");
+  mg_galerkin_ = cl::kernel(program_, "mg_galerkin");
+  mg_smooth_ = cl::kernel(program_, "mg_smooth");
+  mg_restrict_residual_ = cl::kernel(program_, "mg_restrict_residual");
+  mg_prolong_ = cl::kernel(program_, "mg_prolong");
+  mg_coarse_solve_ = cl::kernel(program_, "mg_coarse_solve");
+  cg_init_ = cl::kernel(program_, "cg_init");
+  cg_apply_ = cl::kernel(program_, "cg_apply");
+  cg_reduce_ = cl::kernel(program_, "cg_reduce");
+  cg_update_ = cl::kernel(program_, "cg_update");
+  cg_direction_ = cl::kernel(program_, "cg_direction");
+  load_mask_bits_ = cl::kernel(program_, "load_mask_bits");
+  load_bgr_ = cl::kernel(program_, "load_bgr");
+  store_bgr_ = cl::kernel(program_, "store_bgr");
+}
+
+void poisson_blending_cl::operator()(gil::mat_cview<uint8_t> mask,
+                                     gil::mat_cview<gil::vec3f> src,
+                                     gil::mat_cview<gil::vec3f> dst,
+                                     gil::mat_view<gil::vec3f> result,
+                                     GradientMethod method) {
+  // The frames are written and read back as they are, in float.
+  images im = make_images(mask.cols(), mask.rows(), cl::channel_type::kFloat,
+                          solver_);
+
+  // Initialise cl_mask using the mask image data
+  cl::event upload_first = cl::write_image(im.mask,
+    {0, 0, 0}, {mask.cols(), mask.rows(), 1}, mask.pitch(),
+    reinterpret_cast<const uint8_t*>(mask.data()))
+    (queue_, {});
+
+  // Initialise cl_f using the destination image data
+  cl::write_image(im.f,
+    {0, 0, 0}, {dst.cols(), dst.rows(), 1}, dst.pitch(),
+    reinterpret_cast<const uint8_t*>(dst.data()))
+    (queue_, {});
+
+  // Initialise cl_g using the source image data
+  cl::event upload_last = cl::write_image(im.g,
+    {0, 0, 0}, {src.cols(), src.rows(), 1}, src.pitch(),
+    reinterpret_cast<const uint8_t*>(src.data()))
+    (queue_, {});
+  record("upload", upload_first, upload_last);
+
+  cl::event e1 = solve(im, mask, method, tiles_);
+
+  result = dst;
+  gil::mat<gil::vec3f> tmp(dst.size());
+  // once the last iteration is done, copy the resulting cl_x into tmp matrix.
+  cl::event readback = cl::read_image(im.x,
+    {0, 0, 0}, {tmp.cols(), tmp.rows(), 1}, tmp.pitch(),
+    reinterpret_cast<uint8_t*>(tmp.data()))(queue_, {e1});
+  readback.wait();
+  record("readback", readback);
+  copy(tmp, mask, result); // Apply mask on tmp and paste the output at the corresponding
+                           // region onto result, initialised with destination
+  commit_profile(pending_);
+}
+
+void poisson_blending_cl::blend_codes(gil::mat_cview<uint8_t> codes,
+                                      gil::mat_cview<gil::vec3f> src,
+                                      gil::mat_cview<gil::vec3f> dst,
+                                      gil::mat_view<gil::vec3f> result,
+                                      GradientMethod method) {
+  images im = make_images(codes.cols(), codes.rows(), cl::channel_type::kFloat);
+
+  // The codes take the place of the mask
+  cl::event upload_first = cl::write_image(im.mask,
+    {0, 0, 0}, {codes.cols(), codes.rows(), 1}, codes.pitch(),
+    reinterpret_cast<const uint8_t*>(codes.data()))
+    (queue_, {});
+  cl::write_image(im.f,
+    {0, 0, 0}, {dst.cols(), dst.rows(), 1}, dst.pitch(),
+    reinterpret_cast<const uint8_t*>(dst.data()))
+    (queue_, {});
+  cl::event upload_last = cl::write_image(im.g,
+    {0, 0, 0}, {src.cols(), src.rows(), 1}, src.pitch(),
+    reinterpret_cast<const uint8_t*>(src.data()))
+    (queue_, {});
+  record("upload", upload_first, upload_last);
+
+  cl::event e1 = solve_codes(im, codes, method, tiles_);
+
+  result = dst;
+  gil::mat<gil::vec3f> tmp(dst.size());
+  cl::event readback = cl::read_image(im.x,
+    {0, 0, 0}, {tmp.cols(), tmp.rows(), 1}, tmp.pitch(),
+    reinterpret_cast<uint8_t*>(tmp.data()))(queue_, {e1});
+  readback.wait();
+  record("readback", readback);
+  copy_codes(tmp, codes, result); // pixels outside of the tiles aren't written
+  commit_profile(pending_);
+}
+
+void poisson_blending_cl::operator()(gil::mat_cview<uint8_t> mask,
+                                     gil::mat_cview<gil::vec3b> src,
+                                     gil::mat_cview<gil::vec3b> dst,
+                                     gil::mat_view<gil::vec3b> result,
+                                     GradientMethod method) {
+  job_slot slot;
+  enqueue_job(slot, mask, src, dst, result, method, queue_, queue_);
+  slot.done.wait();
+  commit_profile(pending_);
+}
+
+cl::future<gil::mat_view<gil::vec3b>>
+poisson_blending_cl::submit(gil::mat_cview<uint8_t> mask,
+                            gil::mat_cview<gil::vec3b> src,
+                            gil::mat_cview<gil::vec3b> dst,
+                            gil::mat_view<gil::vec3b> result,
+                            GradientMethod method) {
+  job_slot& slot = slots_[next_slot_];
+  next_slot_ = (next_slot_ + 1) % slots_.size();
+  if (slot.done) {
+    slot.done.wait();
+    commit_profile(slot.pending);
+  }
+
+  enqueue_job(slot, mask, src, dst, result, method,
+              upload_queue_, readback_queue_);
+  slot.pending = std::move(pending_);
+  pending_.clear();
+  upload_queue_.flush();
+  queue_.flush();
+  readback_queue_.flush();
+  return {result, slot.done};
+}
+
+void poisson_blending_cl::finish() {
+  for (auto& slot : slots_) {
+    if (slot.done) {
+      slot.done.wait();
+      commit_profile(slot.pending);
+      slot.done = cl::event();
+    }
+  }
+}
+
+bool poisson_blending_cl::set_storage(cl::channel_type type) {
+  if (type != cl::channel_type::kFloat &&
+      !cl::is_image_format_supported(ctx_, color_format(type))) {
+    return false;
+  }
+  storage_ = type;
+  return true;
+}
+
+poisson_blending_cl::images
+poisson_blending_cl::make_images(size_t cols, size_t rows,
+                                 cl::channel_type storage, SolverMethod solver) {
+  auto make_image = [&](const cl::image_format& format) {
+    return cl::image(ctx_, format,
+      cl::image_desc::make_image_2d(cols, rows), cl::buffer::device);
+  };
+  images im;
+  im.mask = make_image({cl::channel_order::kR, cl::channel_type::kUInt8});
+  im.f = make_image(color_format(storage));
+  im.g = make_image(color_format(storage));
+  im.guidance = make_image(color_format(storage));
+  im.x = solver == SolverMethod::SOR ? im.g : make_image(color_format(storage));
+  return im;
+}
+
+void poisson_blending_cl::upload_part(images& im,
+                                      gil::mat_cview<uint8_t> mask,
+                                      gil::mat_cview<gil::vec3f> src,
+                                      gil::mat_cview<gil::vec3f> dst) {
+  size_t cols = mask.cols(), rows = mask.rows();
+  cl::write_image(im.mask, {0, 0, 0}, {cols, rows, 1}, mask.pitch(),
+    reinterpret_cast<const uint8_t*>(mask.data()))(queue_, {});
+  cl::write_image(im.f, {0, 0, 0}, {cols, rows, 1}, dst.pitch(),
+    reinterpret_cast<const uint8_t*>(dst.data()))(queue_, {});
+  cl::write_image(im.g, {0, 0, 0}, {cols, rows, 1}, src.pitch(),
+    reinterpret_cast<const uint8_t*>(src.data()))(queue_, {});
+  cl::fill_image(im.x, std::array<cl_float, 4>{},
+                 {0, 0, 0}, {cols, rows, 1})(queue_, {});
+}
+
+void poisson_blending_cl::enqueue_job(job_slot& slot,
+                                      gil::mat_cview<uint8_t> mask,
+                                      gil::mat_cview<gil::vec3b> src,
+                                      gil::mat_cview<gil::vec3b> dst,
+                                      gil::mat_view<gil::vec3b> result,
+                                      GradientMethod method,
+                                      cl::weak_command_queue upload_queue,
+                                      cl::weak_command_queue readback_queue) {
+  assert(src.size() == mask.size());
+  assert(dst.size() == mask.size());
+  assert(result.size() == mask.size());
+
+  size_t cols = mask.cols(), rows = mask.rows();
+  cl_int mask_pitch = static_cast<cl_int>((cols + 7) / 8);
+  cl_int frame_pitch = static_cast<cl_int>(cols * sizeof(gil::vec3b));
+  if (slot.cols != cols || slot.rows != rows || slot.storage != storage_ ||
+      slot.solver != solver_) {
+    slot.cols = cols;
+    slot.rows = rows;
+    slot.storage = storage_;
+    slot.solver = solver_;
+    slot.im = make_images(cols, rows, storage_, solver_);
+    slot.mask_bits_buffer = cl::buffer(ctx_, mask_pitch * rows, cl::buffer::device);
+    slot.dst = cl::buffer(ctx_, rows * frame_pitch, cl::buffer::device);
+    slot.src = cl::buffer(ctx_, rows * frame_pitch, cl::buffer::device);
+  }
+  images& im = slot.im;
+  slot.mask_bits = pack_mask(mask);
+
+  cl::event upload_first = cl::write_buffer(slot.mask_bits_buffer, 0,
+    slot.mask_bits.size(), slot.mask_bits.data())(upload_queue, {});
+  cl::write_buffer_rect(slot.dst, cols, rows, dst.pitch(), dst.data())
+    (upload_queue, {});
+  cl::event upload_last = cl::write_buffer_rect(slot.src, cols, rows,
+    src.pitch(), src.data())(upload_queue, {});
+
+  // Expand the mask and convert both frames to float once uploaded.
+  cl::event load_first = cl::invoke_kernel(load_mask_bits_, {cols, rows},
+    std::make_tuple(slot.mask_bits_buffer, mask_pitch, im.mask))
+    (queue_, {upload_last});
+  cl::invoke_kernel(load_bgr_, {cols, rows},
+    std::make_tuple(slot.dst, frame_pitch, im.f))(queue_, cl::no_event);
+  cl::event load_last = cl::invoke_kernel(load_bgr_, {cols, rows},
+    std::make_tuple(slot.src, frame_pitch, im.g))(queue_, {});
+  record("upload", upload_first, upload_last);
+  record("convert", load_first, load_last);
+
+  cl::event e1 = solve(im, mask, method, slot.tiles);
+
+  // Composite the masked solution into the destination frame, which is
+  // then the result.
+  cl::event store = cl::invoke_kernel(store_bgr_, {cols, rows},
+    std::make_tuple(im.x, im.mask, slot.dst, frame_pitch))(queue_, {e1});
+  slot.done = cl::read_buffer_rect(slot.dst, cols, rows,
+    result.pitch(), result.data())(readback_queue, {store});
+  record("convert", store);
+  record("readback", slot.done);
+}
+
+cl::event poisson_blending_cl::solve(images& im, gil::mat_cview<uint8_t> mask,
+                                     GradientMethod method,
+                                     std::vector<cl_int>& tiles) {
+  cl::buffer cl_tiles;
+  cl::buffer cl_x; // the iterate of SolverMethod::SOR, updated in place
+  if (solver_ == SolverMethod::SOR) {
+    cl_x = cl::buffer(ctx_, mask.cols() * mask.rows() * 4 * sizeof(cl_float),
+                      cl::buffer::device);
+  }
+  size_t n_tiles = prepare(im, mask, method, tiles, cl_tiles, cl_x);
+  if (n_tiles == 0) {
+    return queue_.enqueue_marker();
+  }
+
+  switch (solver_) {
+    default:
+    case SolverMethod::JACOBI:
+      return iterate_jacobi(im, cl_tiles, n_tiles, mask.cols(), mask.rows());
+
+    case SolverMethod::SOR:
+      return iterate_sor(im, cl_tiles, cl_x, n_tiles);
+
+    case SolverMethod::MULTIGRID:
+      return iterate_multigrid(im, cl_tiles, n_tiles, mask.cols(), mask.rows());
+
+    case SolverMethod::CG:
+      return iterate_cg(im, cl_tiles, n_tiles, mask.cols(), mask.rows());
+  }
+}
+
+size_t poisson_blending_cl::prepare(images& im, gil::mat_cview<uint8_t> mask,
+                                    GradientMethod method,
+                                    std::vector<cl_int>& tiles,
+                                    cl::buffer& cl_tiles,
+                                    cl::weak_buffer cl_x) {
+  // Formula applied here : for all p in the destination domain (omega)
+  // |N_p| * f_p - sum[all q in (N_p intersection omega)]{f_q} =
+  // sum[all q in (N_p intersection delta_omega)]{f*_q} + sum[all q in N_p]{v_pq}
+  // (equation 7 of http://www.cs.virginia.edu/~connelly/class/2014/comp_photo/proj2/poisson.pdf)
+  // Where N_p are the neighbooring 4 pixels to p, f_p is the intensity of the source at p,
+  // delta_omega is the boundary's domain, f*_q the intensity of the destination at q
+  // and v_pq is the vector guidance field's value for the point between p and q,
+  // ie. v_pq = g_p - g_q, with g_{something} being the source image's value at "something"
+  // Do note that we do not reuse this notation.
+
+  // Kernels only run on the tiles covering the mask and its boundary, with
+  // a work-group per tile.
+  tiles = make_tiles(mask, kTileSize);
+  size_t n_tiles = tiles.size() / 4;
+  if (n_tiles == 0) {
+    return 0;
+  }
+  cl_tiles = cl::buffer(ctx_, tiles.size() * sizeof(cl_int), cl::buffer::device);
+  cl::write_buffer(cl_tiles, 0, tiles.size(), tiles.data())(queue_, {});
+
+  // Initialise cl_guidance with the right side of the poisson equation, and
+  // cl_x with the masked destination, in a single pass. The boundary is
+  // derived from the mask on the fly.
+  if (cl_x != nullptr) {
+    cl::event preparation = cl::invoke_kernel(prepare_buffer_,
+      {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+      std::make_tuple(cl_tiles, im.f, im.g, im.mask, im.guidance, cl_x,
+                      cl_int(method)))(queue_, {});
+    record("prepare", preparation);
+    return n_tiles;
+  }
+  cl::kernel kernel;
+  switch (method) {
+    default:
+    case GradientMethod::BASE:
+      kernel = prepare_;
+      break;
+
+    case GradientMethod::MAX_MIXING:
+      kernel = prepare_mixed_gradient_;
+      break;
+
+    case GradientMethod::AVG_MIXING:
+      kernel = prepare_mixed_gradient_avg_;
+      break;
+  }
+  cl::event preparation = cl::invoke_kernel(kernel,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(cl_tiles, im.f, im.g, im.mask, im.guidance, im.x))
+    (queue_, {});
+
+  record("prepare", preparation);
+  return n_tiles;
+}
+
+cl::event poisson_blending_cl::solve_codes(images& im,
+                                           gil::mat_cview<uint8_t> codes,
+                                           GradientMethod method,
+                                           std::vector<cl_int>& tiles) {
+  tiles = make_code_tiles(codes, kTileSize);
+  size_t n_tiles = tiles.size() / 4;
+  if (n_tiles == 0) {
+    return queue_.enqueue_marker();
+  }
+  cl::buffer cl_tiles(ctx_, tiles.size() * sizeof(cl_int), cl::buffer::device);
+  cl::write_buffer(cl_tiles, 0, tiles.size(), tiles.data())(queue_, {});
+
+  cl::kernel kernel;
+  switch (method) {
+    default:
+    case GradientMethod::BASE:
+      kernel = prepare_codes_;
+      break;
+
+    case GradientMethod::MAX_MIXING:
+      kernel = prepare_codes_mixed_gradient_;
+      break;
+
+    case GradientMethod::AVG_MIXING:
+      kernel = prepare_codes_mixed_gradient_avg_;
+      break;
+  }
+  cl::event preparation = cl::invoke_kernel(kernel,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(cl_tiles, im.f, im.g, im.mask, im.guidance, im.x))
+    (queue_, {});
+  record("prepare", preparation);
+
+  cl::ping_pong_kernel jacobi(jacobi_iteration_codes_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(cl::weak_buffer(cl_tiles), im.x, im.guidance, im.mask, im.g),
+    std::make_tuple(cl::weak_buffer(cl_tiles), im.g, im.guidance, im.mask, im.x));
+  return iterate_jacobi(im, jacobi, kNIter);
+}
+
+cl::event poisson_blending_cl::iterate_jacobi(images& im, cl::weak_buffer tiles,
+                                              size_t n_tiles,
+                                              size_t cols, size_t rows) {
+  return iterate_jacobi(im, make_jacobi(im, tiles, n_tiles, cols, rows), n_iter_);
+}
+
+cl::event poisson_blending_cl::iterate_jacobi(images& im,
+                                              const cl::ping_pong_kernel& jacobi,
+                                              size_t n_iter) {
+  // Using iterative method to calculate cl_x. The queue is in-order, so each
+  // iteration implicitly waits for the previous one (and the first one for
+  // the preparation): launches are enqueued without events and a single
+  // marker tells us when the last one is done. Only the first launch keeps
+  // its event, to time the whole loop. Both parities of the iteration have
+  // their arguments bound once, so the loop itself doesn't call
+  // clSetKernelArg.
+  cl::event jacobi_first = jacobi[0](queue_, {});
+  cl::command_batch batch(queue_, kFlushInterval);
+  for (size_t i = 1; i < n_iter; ++i) {
+    // calculate a new value of intensity field based on the left side of the
+    // equation
+    batch(jacobi[i]);
+  }
+  cl::event jacobi_last = batch.close();
+  if (n_iter % 2 == 1) {
+    im.g.swap(im.x); // last iteration wrote into cl_g
+  }
+
+  record("jacobi", jacobi_first, jacobi_last);
+  return jacobi_last;
+}
+
+cl::event poisson_blending_cl::iterate_sor(images& im, cl::weak_buffer tiles,
+                                           cl::weak_buffer cl_x,
+                                           size_t n_tiles) {
+  // An iteration is a red and a black half-sweep, bound once each.
+  cl::ping_pong_kernel sor(sor_half_sweep_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, cl_x, im.guidance, im.mask, cl_int(0), omega_),
+    std::make_tuple(tiles, cl_x, im.guidance, im.mask, cl_int(1), omega_));
+  cl::event sor_first = sor[0](queue_, {});
+  cl::command_batch batch(queue_, kFlushInterval);
+  for (size_t i = 1; i < 2 * n_iter_; ++i) {
+    batch(sor[i]);
+  }
+  batch.close();
+
+  cl::event sor_last = cl::invoke_kernel(buffer_to_image_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, cl_x, im.x))(queue_, {});
+  record("sor", sor_first, sor_last);
+  return sor_last;
+}
+
+cl::event poisson_blending_cl::iterate_multigrid(images& im,
+                                                 cl::weak_buffer tiles,
+                                                 size_t n_tiles,
+                                                 size_t cols, size_t rows) {
+  std::vector<mg_level> levels;
+  levels.push_back(make_level(cols, rows, 1, 1));
+  while (levels.back().cols > kMgCoarsestExtent ||
+         levels.back().rows > kMgCoarsestExtent) {
+    size_t ratio_x = levels.back().cols > 2 ? 2 : 1;
+    size_t ratio_y = levels.back().rows > 2 ? 2 : 1;
+    size_t coarse_cols = ratio_x == 2 ? levels.back().cols / 2 + 1 : levels.back().cols;
+    size_t coarse_rows = ratio_y == 2 ? levels.back().rows / 2 + 1 : levels.back().rows;
+    levels.push_back(make_level(coarse_cols, coarse_rows, ratio_x, ratio_y));
+  }
+
+  // Pixels outside of the active tiles are outside of the mask: 0.
+  mg_level& finest = levels.front();
+  cl::event mg_first = cl::fill_buffer(finest.x, cl_float(0), 0,
+    4 * cols * rows)(queue_, {});
+  cl::fill_buffer(finest.b, cl_float(0), 0, 4 * cols * rows)(queue_, {});
+  cl::invoke_kernel(image_to_buffer_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, im.x, finest.x))(queue_, cl::no_event);
+  cl::invoke_kernel(image_to_buffer_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, im.guidance, finest.b))(queue_, cl::no_event);
+  cl::invoke_kernel(mg_stencil_, {cols, rows},
+    std::make_tuple(im.mask, finest.a))(queue_, cl::no_event);
+  for (size_t l = 1; l < levels.size(); ++l) {
+    mg_level& fine = levels[l-1];
+    mg_level& coarse = levels[l];
+    cl::invoke_kernel(mg_galerkin_, {coarse.cols, coarse.rows},
+      std::make_tuple(fine.a, cl_int(fine.cols), cl_int(fine.rows),
+                      cl_int(coarse.ratio_x), cl_int(coarse.ratio_y),
+                      coarse.a))(queue_, cl::no_event);
+  }
+
+  cl::command_batch batch(queue_, kFlushInterval);
+  for (size_t i = 0; i < n_iter_; ++i) {
+    v_cycle(levels, 0, batch);
+  }
+  batch.close();
+
+  cl::event mg_last = cl::invoke_kernel(buffer_to_image_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, finest.x, im.x))(queue_, {});
+  record("multigrid", mg_first, mg_last);
+  return mg_last;
+}
+
+void poisson_blending_cl::v_cycle(std::vector<mg_level>& levels, size_t l,
+                                  cl::command_batch& batch) {
+  mg_level& level = levels[l];
+  if (l + 1 == levels.size()) {
+    batch(cl::invoke_kernel(mg_coarse_solve_,
+      {kMgCoarseGroupSize}, {kMgCoarseGroupSize},
+      std::make_tuple(level.x, level.b, level.a, cl_int(level.cols),
+                      cl_int(level.rows), cl_int(kMgCoarseSweeps))));
+    return;
+  }
+
+  mg_level& coarse = levels[l+1];
+  smooth(level, batch);
+  // also clears coarse.x, within the batch
+  batch(cl::invoke_kernel(mg_restrict_residual_, {coarse.cols, coarse.rows},
+    std::make_tuple(level.x, level.b, level.a, cl_int(level.cols),
+                    cl_int(level.rows), cl_int(coarse.ratio_x),
+                    cl_int(coarse.ratio_y), coarse.x, coarse.b)));
+  v_cycle(levels, l + 1, batch);
+  batch(cl::invoke_kernel(mg_prolong_, {level.cols, level.rows},
+    std::make_tuple(coarse.x, cl_int(coarse.cols), cl_int(coarse.ratio_x),
+                    cl_int(coarse.ratio_y), level.x, level.a)));
+  smooth(level, batch);
+}
+
+void poisson_blending_cl::smooth(mg_level& level, cl::command_batch& batch) {
+  for (size_t i = 0; i < 4 * kMgSmoothSweeps; ++i) {
+    batch(cl::invoke_kernel(mg_smooth_, {level.cols, level.rows},
+      std::make_tuple(level.x, level.b, level.a, cl_int(level.cols),
+                      cl_int(level.rows), cl_int(i % 4))));
+  }
+}
+
+cl::event poisson_blending_cl::iterate_cg(images& im, cl::weak_buffer tiles,
+                                          size_t n_tiles,
+                                          size_t cols, size_t rows) {
+  size_t size = cols * rows * 4 * sizeof(cl_float);
+  cl::buffer cl_x(ctx_, size, cl::buffer::device);
+  cl::buffer cl_r(ctx_, size, cl::buffer::device);
+  cl::buffer cl_z(ctx_, size, cl::buffer::device);
+  cl::buffer cl_p(ctx_, size, cl::buffer::device);
+  cl::buffer cl_q(ctx_, size, cl::buffer::device);
+  cl::buffer cl_partial(ctx_, n_tiles * 4 * sizeof(cl_float), cl::buffer::device);
+  // r.z of even and odd iterations, p.q, and r.z of the first iterate
+  cl::buffer cl_scalars(ctx_, 4 * 4 * sizeof(cl_float), cl::buffer::device);
+  std::array<cl_float, 16> scalars;
+
+  std::initializer_list<size_t> global = {n_tiles * kTileSize, kTileSize};
+  std::initializer_list<size_t> local = {kTileSize, kTileSize};
+  cl_int n_partial = static_cast<cl_int>(n_tiles);
+
+  // p is read across the edges of the mask, where it must stay 0.
+  cl::event cg_first = cl::fill_buffer(cl_p, cl_float(0), 0, 4 * cols * rows)
+    (queue_, {});
+  cl::invoke_kernel(image_to_buffer_, global, local,
+    std::make_tuple(tiles, im.x, cl_x))(queue_, cl::no_event);
+  cl::invoke_kernel(cg_init_, global, local,
+    std::make_tuple(tiles, cl_x, im.guidance, im.mask, cl_r, cl_z, cl_p,
+                    cl_partial))(queue_, cl::no_event);
+  cl::invoke_kernel(cg_reduce_, {kCgGroupSize}, {kCgGroupSize},
+    std::make_tuple(cl_partial, n_partial, cl_scalars, cl_int(0)))
+    (queue_, cl::no_event);
+  cl::copy_buffer<cl_float>(cl_scalars, cl_scalars, 0, 12, 4)(queue_, {});
+
+  // Iterations alternate the slot of r.z: even ones read it from 0 and
+  // write the next one to 1, odd ones the other way around.
+  cl::bound_kernel apply(cg_apply_, global, local,
+    std::make_tuple(tiles, cl_p, im.mask, cl_q, cl_partial));
+  cl::bound_kernel reduce_pq(cg_reduce_, {kCgGroupSize}, {kCgGroupSize},
+    std::make_tuple(cl_partial, n_partial, cl_scalars, cl_int(kCgPq)));
+  cl::ping_pong_kernel update(cg_update_, global, local,
+    std::make_tuple(tiles, cl_scalars, cl_int(0), im.mask, cl_p, cl_q,
+                    cl_x, cl_r, cl_z, cl_partial),
+    std::make_tuple(tiles, cl_scalars, cl_int(1), im.mask, cl_p, cl_q,
+                    cl_x, cl_r, cl_z, cl_partial));
+  cl::ping_pong_kernel reduce_rz(cg_reduce_, {kCgGroupSize}, {kCgGroupSize},
+    std::make_tuple(cl_partial, n_partial, cl_scalars, cl_int(1)),
+    std::make_tuple(cl_partial, n_partial, cl_scalars, cl_int(0)));
+  cl::ping_pong_kernel direction(cg_direction_, global, local,
+    std::make_tuple(tiles, cl_scalars, cl_int(0), cl_int(1), im.mask,
+                    cl_z, cl_p),
+    std::make_tuple(tiles, cl_scalars, cl_int(1), cl_int(0), im.mask,
+                    cl_z, cl_p));
+
+  cl::command_batch batch(queue_, kFlushInterval);
+  for (size_t i = 0; i < n_iter_; ++i) {
+    batch(apply);
+    batch(reduce_pq);
+    batch(update[i]);
+    batch(reduce_rz[i]);
+    batch(direction[i]);
+    if ((i + 1) % kCgCheckInterval == 0 && cg_converged(cl_scalars, scalars,
+                                                        (i + 1) % 2)) {
+      break;
+    }
+  }
+  batch.close();
+
+  cl::event cg_last = cl::invoke_kernel(buffer_to_image_, global, local,
+    std::make_tuple(tiles, cl_x, im.x))(queue_, {});
+  record("cg", cg_first, cg_last);
+  return cg_last;
+}
+
+bool poisson_blending_cl::cg_converged(cl::weak_buffer cl_scalars,
+                                       std::array<cl_float, 16>& scalars,
+                                       size_t slot) {
+  cl::event readback = cl::read_buffer(cl_scalars, 0, scalars.size(),
+                                       scalars.data())(queue_, {});
+  readback.wait();
+  for (size_t c = 0; c < 4; ++c) {
+    if (scalars[4 * slot + c] > kCgTolerance * kCgTolerance * scalars[12 + c])
+      return false;
+  }
+  return true;
+}
+
+cl::ping_pong_kernel poisson_blending_cl::make_jacobi(images& im,
+                                                      cl::weak_buffer tiles,
+                                                      size_t n_tiles,
+                                                      size_t cols, size_t rows) {
+  if (jacobi_run_ > 1) {
+    cl_int run = static_cast<cl_int>(jacobi_run_);
+    return cl::ping_pong_kernel(jacobi_iteration_,
+      {(cols + jacobi_run_ - 1) / jacobi_run_, rows},
+      std::make_tuple(im.x, im.guidance, im.mask, im.g, run),
+      std::make_tuple(im.g, im.guidance, im.mask, im.x, run));
+  }
+  return cl::ping_pong_kernel(jacobi_iteration_,
+    {n_tiles * kTileSize, kTileSize}, {kTileSize, kTileSize},
+    std::make_tuple(tiles, im.x, im.guidance, im.mask, im.g),
+    std::make_tuple(tiles, im.g, im.guidance, im.mask, im.x));
+}
+
+void poisson_blending_cl::commit_profile(std::vector<pending_stage>& pending) {
+  for (auto& p : pending) {
+    profile_.add(p.stage, p.first, p.last);
+  }
+  pending.clear();
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <assert.h>
+
+#include <array>
+#include <vector>
+
+#include "gil/mat.hpp"
+#include "gil/vec.hpp"
+#include "poisson.hpp"
+
+#include "cl/device.hpp"
+#include "cl/context.hpp"
+#include "cl/memory.hpp"
+#include "cl/program.hpp"
+#include "cl/kernel.hpp"
+#include "cl/profiler.hpp"
+
+const size_t kFlushInterval = 64; // kernel launches submitted between two flushes
+const float kSorOmega = 1.9f; // over-relaxation factor of the SOR solver
+const size_t kPipelineDepth = 2; // jobs of poisson_blending_cl::submit in flight
+const size_t kHaloRows = 8; // rows exchanged between bands, every as many iterations
+
+// Class to be used to execute the poisson blending with OpenCL.
+// In a class to compile the OpenCL program on c++ compilation
+class poisson_blending_cl {
+ public:
+  // Device images of a blending problem. |f| holds the destination and |g|
+  // the source, which once the guidance is computed becomes the second
+  // buffer of the iterations on |x|. The color images are stored as
+  // |storage|. SolverMethod::SOR iterates in a buffer of its own, so it has
+  // no second buffer and its |x| is the same image as |g|, which only
+  // receives the solution.
+  struct images {
+    cl::image mask;
+    cl::image f;
+    cl::image g;
+    cl::image guidance;
+    cl::image x;
+  };
+
+  // Constructor, builds the OpenCL program for |device|. With |profiling|,
+  // the device time of every stage is recorded in profile().
+  explicit poisson_blending_cl(cl::device device, bool profiling = false);
+
+  /**
+   * Operator calculating the poisson blending using the OpenCL program.
+   * Finds a patch by applying |mask| upon |src| and blend this patch on |dst| at
+   * the corresponding region (again described by applying |mask|). The result
+   * of the blending is put in the output parameter |result|.
+   */
+  void operator()(gil::mat_cview<uint8_t> mask,
+                  gil::mat_cview<gil::vec3f> src,
+                  gil::mat_cview<gil::vec3f> dst,
+                  gil::mat_view<gil::vec3f> result,
+                  GradientMethod method);
+
+  /**
+   * Same as above, with the per-pixel boundary conditions |codes| instead of
+   * a mask, see make_boundary_codes. Runs kNIter Jacobi iterations whatever
+   * the solver selected with set_solver.
+   */
+  void blend_codes(gil::mat_cview<uint8_t> codes,
+                   gil::mat_cview<gil::vec3f> src,
+                   gil::mat_cview<gil::vec3f> dst,
+                   gil::mat_view<gil::vec3f> result,
+                   GradientMethod method);
+
+  /**
+   * Same as above, on 8-bit BGR images. The frames are uploaded as they are,
+   * 3 bytes per pixel, along with the mask packed to 1 bit per pixel, and
+   * converted to float on the device. The result is saturated back to 8 bits
+   * and composited with |dst| on the device, so only the 8-bit frame is read
+   * back.
+   */
+  void operator()(gil::mat_cview<uint8_t> mask,
+                  gil::mat_cview<gil::vec3b> src,
+                  gil::mat_cview<gil::vec3b> dst,
+                  gil::mat_view<gil::vec3b> result,
+                  GradientMethod method);
+
+  /**
+   * Asynchronous version of the above, for a stream of frames: enqueues the
+   * job and returns without waiting, with a future of |result| that is ready
+   * once the blended frame is written into it. The frames and |result| must
+   * stay valid until then. Uploads and readbacks run on their own queues and
+   * the device resources are double-buffered, so that the upload of the next
+   * job and the readback of the previous one overlap the solve of this one.
+   * Waits for the job submitted kPipelineDepth calls ago to be done, to reuse
+   * its resources.
+   */
+  cl::future<gil::mat_view<gil::vec3b>> submit(gil::mat_cview<uint8_t> mask,
+                                               gil::mat_cview<gil::vec3b> src,
+                                               gil::mat_cview<gil::vec3b> dst,
+                                               gil::mat_view<gil::vec3b> result,
+                                               GradientMethod method);
+
+  // Waits for every job submitted with submit().
+  void finish();
+
+  // Selects the channel type of the images of the 8-bit path, f, g, the
+  // guidance and the iterates, which the kernels read and write as float
+  // whatever their storage. cl::channel_type::kHalfFloat halves the memory
+  // traffic of the iterations. Returns false, keeping the current storage,
+  // if the device can't store images of |type|. cl::channel_type::kFloat,
+  // which every other path stores its images as, is always accepted, even
+  // when the device doesn't list its 3-channel format.
+  bool set_storage(cl::channel_type type);
+
+  // Selects the iterative method used by the next calls, with its number of
+  // iterations, V-cycles for SolverMethod::MULTIGRID and an upper bound for
+  // SolverMethod::CG. |omega| is the over-relaxation factor of
+  // SolverMethod::SOR, in ]0, 2[.
+  void set_solver(SolverMethod solver, size_t n_iter, float omega = kSorOmega) {
+    assert(omega > 0.0f && omega < 2.0f);
+    solver_ = solver;
+    n_iter_ = n_iter;
+    omega_ = omega;
+  }
+
+  // Device time spent in each stage, averaged over the calls since the last
+  // clear_profile(). Empty unless the engine was created with profiling.
+  const cl::profiler& profile() const { return profile_; }
+  void clear_profile() { profile_.clear(); }
+
+  // The engines splitting a frame between several devices, or with the host,
+  // drive this one part by part with the following: they upload each part
+  // into images of their own, prepare it and iterate on it on queue().
+
+  // Context and in-order queue of the device, which the kernels run on.
+  cl::weak_context context() const { return ctx_; }
+  cl::weak_command_queue queue() const { return queue_; }
+
+  // Allocates the images of a |cols| x |rows| problem, with the color
+  // images stored as |storage|.
+  images make_images(size_t cols, size_t rows, cl::channel_type storage,
+                     SolverMethod solver = SolverMethod::JACOBI);
+
+  // Uploads the float frames |mask|, |src| and |dst| of a part into |im|,
+  // and clears its iterate. Its halo rows are then copied as whole rows,
+  // including pixels outside of the active tiles, which the kernels never
+  // write.
+  void upload_part(images& im,
+                   gil::mat_cview<uint8_t> mask,
+                   gil::mat_cview<gil::vec3f> src,
+                   gil::mat_cview<gil::vec3f> dst);
+
+  // Prepares the poisson equation on the images |im| of |mask|: uploads the
+  // active tiles of |mask|, built in |tiles|, to |cl_tiles|, and computes the
+  // guidance and the first iterate, in |cl_x| if given, otherwise in |im.x|.
+  // Returns the number of active tiles; if there are none, nothing is
+  // enqueued.
+  size_t prepare(images& im, gil::mat_cview<uint8_t> mask, GradientMethod method,
+                 std::vector<cl_int>& tiles, cl::buffer& cl_tiles,
+                 cl::weak_buffer cl_x = nullptr);
+
+  // Binds both parities of the Jacobi iteration on the |cols| x |rows|
+  // images |im|, with the launch geometry suited to the device: a work-group
+  // per active tile of the |n_tiles| in |tiles|, or runs along the rows of
+  // the whole frame.
+  cl::ping_pong_kernel make_jacobi(images& im, cl::weak_buffer tiles,
+                                   size_t n_tiles, size_t cols, size_t rows);
+
+  // Adds the device time of the stages enqueued since the last call, which
+  // must be complete, to profile().
+  void commit_profile() { commit_profile(pending_); }
+
+ private:
+  // Format of the color images stored as |type|. There is no 3-channel
+  // format for half floats, so those get an unused alpha channel.
+  static cl::image_format color_format(cl::channel_type type) {
+    if (type == cl::channel_type::kHalfFloat) {
+      return {cl::channel_order::kRGBA, type};
+    }
+    return {cl::channel_order::kRGB, type};
+  }
+
+  // Events of a profiled stage, kept until its call is complete.
+  struct pending_stage {
+    const char* stage;
+    cl::event first;
+    cl::event last;
+  };
+
+  // Device resources of a job of the 8-bit path, and the host data they are
+  // uploaded from. A slot can take a new job once |done|, the readback of
+  // its last one, is complete; |pending| are the stages of that job to be
+  // profiled.
+  struct job_slot {
+    size_t cols = 0;
+    size_t rows = 0;
+    cl::channel_type storage = cl::channel_type::kFloat;
+    SolverMethod solver = SolverMethod::JACOBI;
+    images im;
+    std::vector<uint8_t> mask_bits;
+    std::vector<cl_int> tiles;
+    cl::buffer mask_bits_buffer;
+    cl::buffer dst;
+    cl::buffer src;
+    cl::event done;
+    std::vector<pending_stage> pending;
+  };
+
+  // Enqueues a job of the 8-bit path in |slot|, reallocating its resources
+  // if the size of the frames, the storage or the solver changed. The frames are
+  // uploaded on |upload_queue| and the result read back on |readback_queue|,
+  // while the kernels run on queue_; events order the stages across queues.
+  void enqueue_job(job_slot& slot,
+                   gil::mat_cview<uint8_t> mask,
+                   gil::mat_cview<gil::vec3b> src,
+                   gil::mat_cview<gil::vec3b> dst,
+                   gil::mat_view<gil::vec3b> result,
+                   GradientMethod method,
+                   cl::weak_command_queue upload_queue,
+                   cl::weak_command_queue readback_queue);
+
+  // Solves the poisson equation on the images |im| of |mask|, leaving the
+  // solution in |im.x|. The active tiles are built in |tiles|, which must
+  // stay alive until their upload is done. Returns the event of the last
+  // command.
+  cl::event solve(images& im, gil::mat_cview<uint8_t> mask, GradientMethod method,
+                  std::vector<cl_int>& tiles);
+
+  // Same as solve, with the boundary |codes| in |im.mask| instead of a mask,
+  // and kNIter Jacobi iterations.
+  cl::event solve_codes(images& im, gil::mat_cview<uint8_t> codes,
+                        GradientMethod method, std::vector<cl_int>& tiles);
+
+  // Runs the Jacobi iterations on |im|, over the |n_tiles| active |tiles|.
+  cl::event iterate_jacobi(images& im, cl::weak_buffer tiles, size_t n_tiles,
+                           size_t cols, size_t rows);
+
+  // Runs |n_iter| iterations of |jacobi| on |im|.
+  cl::event iterate_jacobi(images& im, const cl::ping_pong_kernel& jacobi,
+                           size_t n_iter);
+
+  // Runs the red-black SOR iterations on |im|, over the |n_tiles| active
+  // |tiles|, from the first iterate prepared in |cl_x|. Images can't be read
+  // and written by the same kernel, so the iterate is updated in place in
+  // this buffer, and only copied into |im.x| once done.
+  cl::event iterate_sor(images& im, cl::weak_buffer tiles, cl::weak_buffer cl_x,
+                        size_t n_tiles);
+
+  // Level of the multigrid pyramid, see poisson.cl. |ratio_x| and |ratio_y|
+  // are its ratios to the level below, 2 along the halved axes and 1 along
+  // the others.
+  struct mg_level {
+    size_t cols;
+    size_t rows;
+    size_t ratio_x;
+    size_t ratio_y;
+    cl::buffer a;
+    cl::buffer x;
+    cl::buffer b;
+  };
+
+  mg_level make_level(size_t cols, size_t rows, size_t ratio_x, size_t ratio_y) {
+    return {cols, rows, ratio_x, ratio_y,
+      cl::buffer(ctx_, 9 * cols * rows * sizeof(cl_float), cl::buffer::device),
+      cl::buffer(ctx_, cols * rows * 4 * sizeof(cl_float), cl::buffer::device),
+      cl::buffer(ctx_, cols * rows * 4 * sizeof(cl_float), cl::buffer::device)};
+  }
+
+  // Runs V-cycles of multigrid on |im|. The finest level is copied from the
+  // |n_tiles| active |tiles| of the images, and the levels are halved until
+  // the coarsest one is at most kMgCoarsestExtent pixels wide and high, few
+  // enough for the sweeps of a single work-group to solve it exactly. Axes
+  // that can't be halved any more are kept, so that elongated frames are
+  // still coarsened along their long axis. The operator of each level is
+  // built on the device from the one below.
+  cl::event iterate_multigrid(images& im, cl::weak_buffer tiles, size_t n_tiles,
+                              size_t cols, size_t rows);
+
+  // Enqueues a V-cycle from level |l| of |levels| down to the coarsest.
+  void v_cycle(std::vector<mg_level>& levels, size_t l, cl::command_batch& batch);
+
+  // Enqueues the 4-color Gauss-Seidel sweeps smoothing |level|.
+  void smooth(mg_level& level, cl::command_batch& batch);
+
+  // Runs Jacobi-preconditioned conjugate gradient on the |n_tiles| active
+  // |tiles| of |im|, for at most n_iter_ iterations. The scalars of the
+  // method stay on the device; only the r.z reached so far is read back,
+  // every kCgCheckInterval iterations, to stop once it dropped by
+  // kCgTolerance^2.
+  cl::event iterate_cg(images& im, cl::weak_buffer tiles, size_t n_tiles,
+                       size_t cols, size_t rows);
+
+  // Reads the r.z of the conjugate gradient from |cl_scalars| into |scalars|,
+  // and returns true if the one in |slot| dropped by kCgTolerance^2 from the
+  // first one, in every channel.
+  bool cg_converged(cl::weak_buffer cl_scalars, std::array<cl_float, 16>& scalars,
+                    size_t slot);
+
+  // Keeps the events of a stage until the call is complete, to add their
+  // device time to profile_ in commit_profile().
+  void record(const char* stage, cl::event first, cl::event last) {
+    if (queue_.profiling()) {
+      pending_.push_back({stage, std::move(first), std::move(last)});
+    }
+  }
+  void record(const char* stage, cl::event e) { record(stage, e, e); }
+
+  void commit_profile(std::vector<pending_stage>& pending);
+
+  cl::device device_;
+  cl::context ctx_;
+  cl::command_queue queue_;
+  cl::command_queue upload_queue_;
+  cl::command_queue readback_queue_;
+  cl::program program_;
+  cl::kernel prepare_;
+  cl::kernel prepare_mixed_gradient_;
+  cl::kernel prepare_mixed_gradient_avg_;
+  cl::kernel prepare_buffer_;
+  cl::kernel jacobi_iteration_;
+  cl::kernel prepare_codes_;
+  cl::kernel prepare_codes_mixed_gradient_;
+  cl::kernel prepare_codes_mixed_gradient_avg_;
+  cl::kernel jacobi_iteration_codes_;
+  size_t jacobi_run_ = 1; // pixels per work-item of jacobi_iteration_
+  std::vector<cl_int> tiles_; // uploaded asynchronously, kept until the next call
+  std::array<job_slot, kPipelineDepth> slots_; // of the jobs of submit()
+  size_t next_slot_ = 0;
+  cl::channel_type storage_ = cl::channel_type::kFloat;
+  SolverMethod solver_ = SolverMethod::JACOBI;
+  size_t n_iter_ = kNIter;
+  float omega_ = kSorOmega;
+  cl::kernel image_to_buffer_;
+  cl::kernel buffer_to_image_;
+  cl::kernel sor_half_sweep_;
+  cl::kernel mg_stencil_;
+  cl::kernel mg_galerkin_;
+  cl::kernel mg_smooth_;
+  cl::kernel mg_restrict_residual_;
+  cl::kernel mg_prolong_;
+  cl::kernel mg_coarse_solve_;
+  cl::kernel cg_init_;
+  cl::kernel cg_apply_;
+  cl::kernel cg_reduce_;
+  cl::kernel cg_update_;
+  cl::kernel cg_direction_;
+  cl::kernel load_mask_bits_;
+  cl::kernel load_bgr_;
+  cl::kernel store_bgr_;
+  cl::profiler profile_;
+  std::vector<pending_stage> pending_;
+};
@@ -0,0 +1,129 @@
+#include "poisson_cl_bands.hpp"
+
+#include <algorithm>
+
+#include "poisson_serial.hpp"
+
+poisson_blending_cl_bands::poisson_blending_cl_bands(
+    const std::vector<cl::device>& devices, size_t halo)
+    : halo_(halo) {
+  assert(!devices.empty());
+  assert(halo_ > 0 && halo_ % 2 == 0);
+  for (auto& device : devices) {
+    engines_.emplace_back(new poisson_blending_cl(device));
+  }
+}
+
+void poisson_blending_cl_bands::operator()(gil::mat_cview<uint8_t> mask,
+                                           gil::mat_cview<gil::vec3f> src,
+                                           gil::mat_cview<gil::vec3f> dst,
+                                           gil::mat_view<gil::vec3f> result,
+                                           GradientMethod method) {
+  size_t cols = mask.cols(), rows = mask.rows();
+
+  // Bands are at least as tall as the halo, which then comes from the
+  // nearest band alone.
+  size_t n_bands = std::max<size_t>(1, std::min(engines_.size(), rows / halo_));
+  std::vector<band> bands(n_bands);
+  std::vector<cl::ping_pong_kernel> jacobi;
+  for (size_t b = 0; b < n_bands; ++b) {
+    band& bd = bands[b];
+    bd.engine = engines_[b].get();
+    bd.begin = rows * b / n_bands;
+    bd.end = rows * (b + 1) / n_bands;
+    bd.first = bd.begin < halo_ ? 0 : bd.begin - halo_;
+    bd.last = std::min(rows, bd.end + halo_);
+    prepare_band(bd, mask, src, dst, method);
+    jacobi.push_back(bd.engine->make_jacobi(bd.im, bd.cl_tiles, bd.n_tiles,
+                                            cols, bd.last - bd.first));
+  }
+
+  for (size_t i = 0; i < kNIter; i += halo_) {
+    for (size_t b = 0; b < n_bands; ++b) {
+      if (bands[b].n_tiles == 0) {
+        continue;
+      }
+      cl::command_batch batch(bands[b].engine->queue(), kFlushInterval);
+      for (size_t j = 0; j < halo_; ++j) {
+        batch(jacobi[b][j]);
+      }
+      batch.close();
+    }
+    if (i + halo_ < kNIter) {
+      exchange_halos(bands, cols);
+    }
+  }
+
+  // Read the rows each band owns back into a single frame.
+  gil::mat<gil::vec3f> tmp(dst.size());
+  std::vector<cl::event> readbacks;
+  for (auto& bd : bands) {
+    readbacks.push_back(cl::read_image(bd.im.x,
+      {0, bd.begin - bd.first, 0}, {cols, bd.end - bd.begin, 1}, tmp.pitch(),
+      reinterpret_cast<uint8_t*>(tmp.row_begin(bd.begin)))
+      (bd.engine->queue(), {}));
+  }
+  for (auto& e : readbacks) {
+    e.wait();
+  }
+  result = dst;
+  copy(tmp, mask, result);
+}
+
+void poisson_blending_cl_bands::prepare_band(band& bd,
+                                             gil::mat_cview<uint8_t> mask,
+                                             gil::mat_cview<gil::vec3f> src,
+                                             gil::mat_cview<gil::vec3f> dst,
+                                             GradientMethod method) {
+  poisson_blending_cl& engine = *bd.engine;
+  size_t cols = mask.cols(), rows = bd.last - bd.first;
+  gil::vec4<size_t> frame = {bd.first, 0, rows, cols};
+  gil::mat_cview<uint8_t> band_mask = mask[frame];
+  gil::mat_cview<gil::vec3f> band_src = src[frame];
+  gil::mat_cview<gil::vec3f> band_dst = dst[frame];
+
+  bd.im = engine.make_images(cols, rows, cl::channel_type::kFloat);
+  engine.upload_part(bd.im, band_mask, band_src, band_dst);
+  bd.n_tiles = engine.prepare(bd.im, band_mask, method, bd.tiles, bd.cl_tiles);
+}
+
+void poisson_blending_cl_bands::exchange_halos(std::vector<band>& bands,
+                                               size_t cols) {
+  struct transfer {
+    band* from;
+    band* to;
+    size_t row; // first row of the frame
+    size_t n_rows;
+    std::vector<gil::vec3f> rows;
+  };
+  std::vector<transfer> transfers;
+  for (size_t b = 0; b + 1 < bands.size(); ++b) {
+    band& up = bands[b];
+    band& down = bands[b+1];
+    transfers.push_back({&down, &up, up.end, up.last - up.end, {}});
+    transfers.push_back({&up, &down, down.first, down.begin - down.first, {}});
+  }
+
+  std::vector<cl::event> reads;
+  for (auto& t : transfers) {
+    t.rows.resize(t.n_rows * cols);
+    reads.push_back(cl::read_image(t.from->im.x,
+      {0, t.row - t.from->first, 0}, {cols, t.n_rows, 1},
+      cols * sizeof(gil::vec3f), reinterpret_cast<uint8_t*>(t.rows.data()))
+      (t.from->engine->queue(), {}));
+  }
+  for (auto& e : reads) {
+    e.wait();
+  }
+  std::vector<cl::event> writes;
+  for (auto& t : transfers) {
+    writes.push_back(cl::write_image(t.to->im.x,
+      {0, t.row - t.to->first, 0}, {cols, t.n_rows, 1},
+      cols * sizeof(gil::vec3f), reinterpret_cast<const uint8_t*>(t.rows.data()))
+      (t.to->engine->queue(), {}));
+  }
+  // |transfers| holds the rows being written.
+  for (auto& e : writes) {
+    e.wait();
+  }
+}
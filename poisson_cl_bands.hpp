@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "poisson_cl.hpp"
+
+/**
+ * Poisson blending with the OpenCL program split over several devices, with
+ * Jacobi iterations. The frame is cut into horizontal bands, one per device,
+ * each extended by |halo| rows of its neighboors. Each band iterates on the
+ * queue of its device, and every |halo| iterations the halo rows of each band
+ * are refreshed through the host from the band that owns them. The rows
+ * missing past the halo only spoil one more row per iteration, so they never
+ * reach the rows a band owns: the result is the one of a single device.
+ */
+class poisson_blending_cl_bands {
+ public:
+  // Builds the OpenCL program for each of |devices|. |halo| must be even, so
+  // that the halos are exchanged with the iterate always in the same image.
+  explicit poisson_blending_cl_bands(const std::vector<cl::device>& devices,
+                                     size_t halo = kHaloRows);
+
+  /**
+   * Same as poisson_blending_cl::operator(), running kNIter iterations
+   * rounded up to a multiple of the halo.
+   */
+  void operator()(gil::mat_cview<uint8_t> mask,
+                  gil::mat_cview<gil::vec3f> src,
+                  gil::mat_cview<gil::vec3f> dst,
+                  gil::mat_view<gil::vec3f> result,
+                  GradientMethod method);
+
+ private:
+  // Rows [first, last) of the frame, solved by |engine|, of which the band
+  // owns [begin, end).
+  struct band {
+    poisson_blending_cl* engine = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+    size_t first = 0;
+    size_t last = 0;
+    poisson_blending_cl::images im;
+    std::vector<cl_int> tiles;
+    cl::buffer cl_tiles;
+    size_t n_tiles = 0;
+  };
+
+  // Uploads the rows of |bd| and prepares its equation.
+  void prepare_band(band& bd,
+                    gil::mat_cview<uint8_t> mask,
+                    gil::mat_cview<gil::vec3f> src,
+                    gil::mat_cview<gil::vec3f> dst,
+                    GradientMethod method);
+
+  // Copies the halo rows of each band from the bands that own them, through
+  // the host.
+  void exchange_halos(std::vector<band>& bands, size_t cols);
+
+  size_t halo_;
+  std::vector<std::unique_ptr<poisson_blending_cl>> engines_;
+};
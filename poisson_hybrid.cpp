@@ -0,0 +1,132 @@
+#include "poisson_hybrid.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "poisson_serial.hpp"
+#include "poisson_tbb.hpp"
+
+poisson_blending_hybrid::poisson_blending_hybrid(cl::device device, size_t halo)
+    : engine_(device, true),
+      halo_(halo) {
+  assert(halo_ > 0 && halo_ % 2 == 0);
+}
+
+void poisson_blending_hybrid::operator()(gil::mat_cview<uint8_t> mask,
+                                         gil::mat_cview<gil::vec3f> src,
+                                         gil::mat_cview<gil::vec3f> dst,
+                                         gil::mat_view<gil::vec3f> result,
+                                         GradientMethod method) {
+  size_t cols = mask.cols(), rows = mask.rows();
+  if (rows < 4 * halo_) {
+    engine_(mask, src, dst, result, method);
+    return;
+  }
+  size_t split = static_cast<size_t>(host_share_ * rows);
+  split = std::min(std::max(split, 2 * halo_), rows - 2 * halo_);
+
+  // The host part, rows [0, split + halo_) of the frame.
+  size_t host_rows = split + halo_;
+  gil::vec4<size_t> host_frame = {0, 0, host_rows, cols};
+  gil::mat_cview<uint8_t> host_mask = mask[host_frame];
+  gil::mat<gil::vec3f> guidance({host_rows, cols});
+  gil::mat<gil::vec3f> x({host_rows, cols});
+  tbb_prepare(dst[host_frame], src[host_frame], host_mask, method, guidance, x);
+  gil::mat<gil::vec3f> y = x;
+
+  // The device part, rows [split - halo_, rows) of the frame.
+  size_t device_first = split - halo_;
+  size_t device_rows = rows - device_first;
+  gil::vec4<size_t> device_frame = {device_first, 0, device_rows, cols};
+  gil::mat_cview<uint8_t> device_mask = mask[device_frame];
+  gil::mat_cview<gil::vec3f> device_src = src[device_frame];
+  gil::mat_cview<gil::vec3f> device_dst = dst[device_frame];
+  cl::weak_command_queue queue = engine_.queue();
+  poisson_blending_cl::images im =
+      engine_.make_images(cols, device_rows, cl::channel_type::kFloat);
+  engine_.upload_part(im, device_mask, device_src, device_dst);
+  std::vector<cl_int> tiles;
+  cl::buffer cl_tiles;
+  size_t n_tiles = engine_.prepare(im, device_mask, method, tiles, cl_tiles);
+  cl::ping_pong_kernel jacobi = engine_.make_jacobi(im, cl_tiles, n_tiles,
+                                                    cols, device_rows);
+
+  // Rows sent to the host then rows sent to the device, in host memory.
+  size_t halo_size = halo_ * cols;
+  cl::buffer halos(engine_.context(), 2 * halo_size * sizeof(gil::vec3f), cl::buffer::host);
+
+  std::chrono::duration<double> host_time(0);
+  std::chrono::nanoseconds device_time(0);
+  for (size_t i = 0; i < kNIter; i += halo_) {
+    // The device iterates while the host does.
+    cl::event first, last;
+    if (n_tiles != 0) {
+      first = jacobi[0](queue, {});
+      cl::command_batch batch(queue, kFlushInterval);
+      for (size_t j = 1; j < halo_; ++j) {
+        batch(jacobi[j]);
+      }
+      last = batch.close();
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t j = 0; j < halo_; j += 2) {
+      tbb_jacobi_iteration(x, guidance, host_mask, y);
+      tbb_jacobi_iteration(y, guidance, host_mask, x);
+    }
+    host_time += std::chrono::high_resolution_clock::now() - start;
+
+    if (n_tiles != 0) {
+      last.wait();
+      device_time += std::chrono::nanoseconds(last.end_time() - first.start_time());
+    }
+    if (i + halo_ < kNIter) {
+      exchange_halos(x, split, im.x, halos, cols);
+    }
+  }
+
+  // Gather the rows owned by each part.
+  gil::mat<gil::vec3f> tmp(dst.size());
+  cl::event readback = cl::read_image(im.x,
+    {0, halo_, 0}, {cols, rows - split, 1}, tmp.pitch(),
+    reinterpret_cast<uint8_t*>(tmp.row_begin(split)))(queue, {});
+  for (size_t r = 0; r < split; ++r) {
+    std::copy(x.row_begin(r), x.row_end(r), tmp.row_begin(r));
+  }
+  readback.wait();
+  engine_.commit_profile();
+  result = dst;
+  copy(tmp, mask, result);
+
+  // Give each part a share of the rows proportional to its throughput.
+  if (n_tiles != 0 && host_time.count() > 0 && device_time.count() > 0) {
+    double host_rate = split / host_time.count();
+    double device_rate = (rows - split) /
+        std::chrono::duration<double>(device_time).count();
+    host_share_ = host_rate / (host_rate + device_rate);
+  }
+}
+
+void poisson_blending_hybrid::exchange_halos(gil::mat_view<gil::vec3f> x,
+                                             size_t split,
+                                             cl::weak_image device_x,
+                                             cl::weak_buffer halos,
+                                             size_t cols) {
+  cl::weak_command_queue queue = engine_.queue();
+  size_t halo_size = halo_ * cols;
+  cl::copy_image_to_buffer(device_x, halos,
+    {0, halo_, 0}, {cols, halo_, 1}, 0)(queue, {});
+  auto mapped = cl::map_buffer<gil::vec3f>(halos, cl::map_access::read_write,
+    0, 2 * halo_size)(queue, {});
+  gil::vec3f* ptr = mapped.get();
+
+  for (size_t r = 0; r < halo_; ++r) {
+    std::copy(ptr + r * cols, ptr + (r + 1) * cols, x.row_begin(split + r));
+    std::copy(x.row_begin(split - halo_ + r), x.row_end(split - halo_ + r),
+              ptr + halo_size + r * cols);
+  }
+
+  cl::unmap_buffer(halos, ptr)(queue, {});
+  cl::copy_buffer_to_image(halos, device_x, halo_size * sizeof(gil::vec3f),
+    {0, 0, 0}, {cols, halo_, 1})(queue, {});
+}
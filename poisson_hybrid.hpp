@@ -0,0 +1,43 @@
+#pragma once
+
+#include "poisson_cl.hpp"
+
+/**
+ * Poisson blending with Jacobi iterations shared between the host, with tbb,
+ * and an OpenCL device. The top rows of the frame are solved on the host and
+ * the bottom ones on the device, each part extended by |halo| rows of the
+ * other, as in poisson_blending_cl_bands. Every |halo| iterations, the halo
+ * rows are exchanged through a buffer mapped in host memory. The share of
+ * rows given to the host is rebalanced after each call from the throughput
+ * of both parts.
+ */
+class poisson_blending_hybrid {
+ public:
+  // Builds the OpenCL program for |device|. |halo| must be even.
+  explicit poisson_blending_hybrid(cl::device device, size_t halo = kHaloRows);
+
+  /**
+   * Same as poisson_blending_cl::operator(), running kNIter iterations
+   * rounded up to a multiple of the halo.
+   */
+  void operator()(gil::mat_cview<uint8_t> mask,
+                  gil::mat_cview<gil::vec3f> src,
+                  gil::mat_cview<gil::vec3f> dst,
+                  gil::mat_view<gil::vec3f> result,
+                  GradientMethod method);
+
+  // Share of the rows of the frame solved on the host by the next call.
+  double host_share() const { return host_share_; }
+
+ private:
+  // Copies the first halo_ rows owned by the device into the halo of the
+  // host iterate |x|, and the last halo_ rows owned by the host into the
+  // halo of the device iterate |device_x|, through the mapped |halos|.
+  void exchange_halos(gil::mat_view<gil::vec3f> x, size_t split,
+                      cl::weak_image device_x, cl::weak_buffer halos,
+                      size_t cols);
+
+  poisson_blending_cl engine_;
+  size_t halo_;
+  double host_share_ = 0.5;
+};
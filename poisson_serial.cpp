@@ -31,6 +31,29 @@ gil::mat<uint8_t> make_boundary(gil::mat_cview<uint8_t> mask) {
   return boundary;
 }
 
+/**
+ * Calculates the boundary codes of the region delimited by |mask|, as
+ * blend::seamlessBlend does: pixels outside of the mask are Dirichlet, those
+ * of the mask on the image border are Neumann and the others are unknown.
+ */
+gil::mat<uint8_t> make_boundary_codes(gil::mat_cview<uint8_t> mask) {
+  gil::mat<uint8_t> codes({mask.rows(), mask.cols()});
+  for (size_t i = 0; i < mask.rows(); ++i) {
+    bool border_row = i == 0 || i == mask.rows()-1;
+    auto mask_it = mask.row_cbegin(i);
+    auto codes_it = codes.row_begin(i);
+    for (size_t j = 0; j < mask.cols(); ++j, ++mask_it, ++codes_it) {
+      if (*mask_it < 128)
+        *codes_it = kDirichletCode;
+      else if (border_row || j == 0 || j == mask.cols()-1)
+        *codes_it = kNeumannCode;
+      else
+        *codes_it = kUnknownCode;
+    }
+  }
+  return codes;
+}
+
 gil::mat<gil::vec3f> make_guidance(gil::mat_cview<gil::vec3f> f,
                                    gil::mat_cview<gil::vec3f> g,
                                    gil::mat_cview<uint8_t> mask,
@@ -195,6 +218,325 @@ gil::mat<gil::vec3f> make_guidance_mixed_gradient_avg(gil::mat_cview<gil::vec3f>
   return dst;
 }
 
+namespace {
+
+// Rows and columns of the 4 neighboors of a pixel: left, right, up and down,
+// so that the opposite of neighboor d is d ^ 1.
+const int kNeighboorRows[4] = {0, 0, -1, 1};
+const int kNeighboorCols[4] = {-1, 1, 0, 0};
+
+// Offset of neighboor |d| in an image of stride |step|.
+ptrdiff_t neighboor(int d, size_t step) {
+  return kNeighboorRows[d] * static_cast<ptrdiff_t>(step) + kNeighboorCols[d];
+}
+
+/**
+ * Lists in |dirs| the neighboors that the equation of pixel (|i|, |j|) reads
+ * given the boundary |codes|, and returns their number, which is the
+ * diagonal coefficient of the equation. As in blend::solvePoissonEquations,
+ * a neighboor outside of the image is dropped for an unknown pixel. For a
+ * Neumann pixel, it is replaced by the opposite neighboor, and so is a
+ * Dirichlet one; if the opposite one isn't available either, both are
+ * dropped.
+ */
+size_t stencil(gil::mat_cview<uint8_t> codes, size_t i, size_t j, int dirs[4]) {
+  uint8_t code = codes.row_cbegin(i)[j];
+  // Neumann values are 0, see kNeumannCode
+  assert(code != kNeumannCode || i == 0 || i == codes.rows()-1 ||
+         j == 0 || j == codes.cols()-1);
+  bool available[4];
+  for (int d = 0; d < 4; ++d) {
+    ptrdiff_t k = static_cast<ptrdiff_t>(i) + kNeighboorRows[d];
+    ptrdiff_t l = static_cast<ptrdiff_t>(j) + kNeighboorCols[d];
+    available[d] = k >= 0 && k < static_cast<ptrdiff_t>(codes.rows()) &&
+                   l >= 0 && l < static_cast<ptrdiff_t>(codes.cols()) &&
+                   !(code == kNeumannCode && codes.row_cbegin(k)[l] == kDirichletCode);
+  }
+  size_t count = 0;
+  for (int d = 0; d < 4; ++d) {
+    if (available[d])
+      dirs[count++] = d;
+    else if (code == kNeumannCode && available[d ^ 1])
+      dirs[count++] = d ^ 1;
+  }
+  return count;
+}
+
+/**
+ * Sum of the 4 vectors of the guidance field around a pixel of the mask,
+ * for each GradientMethod. |f_it| and |g_it| point to the pixel in the
+ * destination and source images.
+ */
+struct BaseGradient {
+  gil::vec3f operator()(const gil::vec3f*, const gil::vec3f* g_it,
+                        size_t, size_t g_step) const {
+    return 4.0f**g_it - (g_it[-1] + g_it[1] + g_it[-g_step] + g_it[g_step]);
+  }
+
+  // Same, over the |count| neighboors |dirs| of the pixel's stencil.
+  gil::vec3f operator()(const gil::vec3f*, const gil::vec3f* g_it,
+                        size_t, size_t g_step,
+                        const int* dirs, size_t count) const {
+    gil::vec3f res = float(count) * *g_it;
+    for (size_t k = 0; k < count; ++k)
+      res -= g_it[neighboor(dirs[k], g_step)];
+    return res;
+  }
+};
+
+struct MixedGradient {
+  gil::vec3f operator()(const gil::vec3f* f_it, const gil::vec3f* g_it,
+                        size_t f_step, size_t g_step) const {
+    gil::vec3f v[2][4] = {{*g_it - g_it[-1],
+                           *g_it - g_it[1],
+                           *g_it - g_it[-g_step],
+                           *g_it - g_it[g_step]},
+                          {*f_it - f_it[-1],
+                           *f_it - f_it[1],
+                           *f_it - f_it[-f_step],
+                           *f_it - f_it[f_step]}};
+    gil::vec3f res = {};
+    for (int k = 0; k < 4; ++k) { // for each neighboor
+      //Use the highest gradient between the one from f* and the one from g
+      int x = gil::norm2(v[0][k]) > gil::norm2(v[1][k]) ? 0 : 1;
+      res += v[x][k];
+    }
+    return res;
+  }
+
+  gil::vec3f operator()(const gil::vec3f* f_it, const gil::vec3f* g_it,
+                        size_t f_step, size_t g_step,
+                        const int* dirs, size_t count) const {
+    gil::vec3f res = {};
+    for (size_t k = 0; k < count; ++k) {
+      gil::vec3f v_g = *g_it - g_it[neighboor(dirs[k], g_step)];
+      gil::vec3f v_f = *f_it - f_it[neighboor(dirs[k], f_step)];
+      res += gil::norm2(v_g) > gil::norm2(v_f) ? v_g : v_f;
+    }
+    return res;
+  }
+};
+
+struct MixedGradientAvg {
+  gil::vec3f operator()(const gil::vec3f* f_it, const gil::vec3f* g_it,
+                        size_t f_step, size_t g_step) const {
+    gil::vec3f res = 0.5f * (4.0f**g_it - (g_it[-1] + g_it[1] + g_it[-g_step] + g_it[g_step]));
+    res += 0.5f * (4.0f**f_it - (f_it[-1] + f_it[1] + f_it[-f_step] + f_it[f_step]));
+    return res;
+  }
+
+  gil::vec3f operator()(const gil::vec3f* f_it, const gil::vec3f* g_it,
+                        size_t f_step, size_t g_step,
+                        const int* dirs, size_t count) const {
+    gil::vec3f res = 0.5f * float(count) * (*g_it + *f_it);
+    for (size_t k = 0; k < count; ++k)
+      res -= 0.5f * (g_it[neighboor(dirs[k], g_step)] + f_it[neighboor(dirs[k], f_step)]);
+    return res;
+  }
+};
+
+template <class Gradient>
+void prepare_block(gil::mat_cview<gil::vec3f> f,
+                   gil::mat_cview<gil::vec3f> g,
+                   gil::mat_cview<uint8_t> mask,
+                   Gradient gradient,
+                   size_t row_begin, size_t row_end,
+                   size_t col_begin, size_t col_end,
+                   gil::mat_view<gil::vec3f> guidance,
+                   gil::mat_view<gil::vec3f> iterate) {
+  size_t mask_step = mask.stride();
+  size_t f_step = f.stride();
+  size_t g_step = g.stride();
+  for (size_t i = row_begin; i < row_end; ++i) {
+    bool border_row = i == 0 || i == mask.rows()-1;
+    auto mask_it = mask.row_cbegin(i)+col_begin;
+    auto f_it = f.row_cbegin(i)+col_begin;
+    auto g_it = g.row_cbegin(i)+col_begin;
+    auto guidance_it = guidance.row_begin(i)+col_begin;
+    auto iterate_it = iterate.row_begin(i)+col_begin;
+    for (size_t j = col_begin; j < col_end;
+         ++j, ++mask_it, ++f_it, ++g_it, ++guidance_it, ++iterate_it) {
+      if (*mask_it < 128) { // outside of the mask, both are masked out
+        *guidance_it = {};
+        *iterate_it = {};
+        continue;
+      }
+      *iterate_it = *f_it; // the destination is the first iterate
+      if (border_row || j == 0 || j == mask.cols()-1) {
+        *guidance_it = {};
+        continue;
+      }
+      //2nd summation of the right side of the equation
+      gil::vec3f temp = gradient(f_it, g_it, f_step, g_step);
+      // 1st part of the right side of the equation: the neighboors of a pixel
+      // of the mask which are outside of it are exactly its neighboors on
+      // the boundary.
+      if (mask_it[-1] < 128)
+        temp += f_it[-1];
+      if (mask_it[1] < 128)
+        temp += f_it[1];
+      if (mask_it[-mask_step] < 128)
+        temp += f_it[-f_step];
+      if (mask_it[mask_step] < 128)
+        temp += f_it[f_step];
+      *guidance_it = temp;
+    }
+  }
+}
+
+template <class Gradient>
+void prepare_block_codes(gil::mat_cview<gil::vec3f> f,
+                         gil::mat_cview<gil::vec3f> g,
+                         gil::mat_cview<uint8_t> codes,
+                         Gradient gradient,
+                         size_t row_begin, size_t row_end,
+                         size_t col_begin, size_t col_end,
+                         gil::mat_view<gil::vec3f> guidance,
+                         gil::mat_view<gil::vec3f> iterate) {
+  size_t f_step = f.stride();
+  size_t g_step = g.stride();
+  for (size_t i = row_begin; i < row_end; ++i) {
+    bool border_row = i == 0 || i == codes.rows()-1;
+    auto codes_it = codes.row_cbegin(i)+col_begin;
+    auto f_it = f.row_cbegin(i)+col_begin;
+    auto g_it = g.row_cbegin(i)+col_begin;
+    auto guidance_it = guidance.row_begin(i)+col_begin;
+    auto iterate_it = iterate.row_begin(i)+col_begin;
+    for (size_t j = col_begin; j < col_end;
+         ++j, ++codes_it, ++f_it, ++g_it, ++guidance_it, ++iterate_it) {
+      // the destination is the first iterate, and Dirichlet pixels keep it
+      *iterate_it = *f_it;
+      if (*codes_it == kDirichletCode) {
+        *guidance_it = {};
+      } else if (*codes_it == kUnknownCode && !border_row && j != 0 && j != codes.cols()-1) {
+        *guidance_it = gradient(f_it, g_it, f_step, g_step);
+      } else {
+        int dirs[4];
+        size_t count = stencil(codes, i, j, dirs);
+        *guidance_it = gradient(f_it, g_it, f_step, g_step, dirs, count);
+      }
+    }
+  }
+}
+
+}
+
+/**
+ * Computes, in a single pass over the block [row_begin, row_end) x
+ * [col_begin, col_end), the masked guidance field of the poisson equation
+ * and the first Jacobi iterate, which is the destination image |f| inside
+ * the |mask| and 0 elsewhere. The boundary is derived from the mask's
+ * neighboorhood on the fly.
+ */
+void prepare_block(gil::mat_cview<gil::vec3f> f,
+                   gil::mat_cview<gil::vec3f> g,
+                   gil::mat_cview<uint8_t> mask,
+                   GradientMethod method,
+                   size_t row_begin, size_t row_end,
+                   size_t col_begin, size_t col_end,
+                   gil::mat_view<gil::vec3f> guidance,
+                   gil::mat_view<gil::vec3f> iterate) {
+  switch (method) {
+    default:
+    case GradientMethod::BASE:
+      prepare_block(f, g, mask, BaseGradient(), row_begin, row_end,
+                    col_begin, col_end, guidance, iterate);
+      break;
+
+    case GradientMethod::MAX_MIXING:
+      prepare_block(f, g, mask, MixedGradient(), row_begin, row_end,
+                    col_begin, col_end, guidance, iterate);
+      break;
+
+    case GradientMethod::AVG_MIXING:
+      prepare_block(f, g, mask, MixedGradientAvg(), row_begin, row_end,
+                    col_begin, col_end, guidance, iterate);
+      break;
+  }
+}
+
+/**
+ * Computes the masked |guidance| field and the first |iterate| of the
+ * poisson equation, block by block. Replaces make_guidance, apply_mask and
+ * copy of the destination.
+ */
+void prepare(gil::mat_cview<gil::vec3f> f,
+             gil::mat_cview<gil::vec3f> g,
+             gil::mat_cview<uint8_t> mask,
+             GradientMethod method,
+             gil::mat_view<gil::vec3f> guidance,
+             gil::mat_view<gil::vec3f> iterate) {
+  assert(f.size() == mask.size());
+  assert(g.size() == mask.size());
+  assert(guidance.size() == mask.size());
+  assert(iterate.size() == mask.size());
+  for (size_t i = 0; i < mask.rows(); i += kPrepareBlockRows) {
+    for (size_t j = 0; j < mask.cols(); j += kPrepareBlockCols) {
+      prepare_block(f, g, mask, method,
+                    i, std::min(i + kPrepareBlockRows, mask.rows()),
+                    j, std::min(j + kPrepareBlockCols, mask.cols()),
+                    guidance, iterate);
+    }
+  }
+}
+
+/**
+ * Same as prepare_block, with the per-pixel boundary conditions |codes|
+ * instead of a mask. The first |iterate| is the destination image |f| on
+ * every pixel: Dirichlet pixels keep their value in it, where the equations
+ * of their neighboors read it, so the |guidance| has no boundary term.
+ */
+void prepare_block_codes(gil::mat_cview<gil::vec3f> f,
+                         gil::mat_cview<gil::vec3f> g,
+                         gil::mat_cview<uint8_t> codes,
+                         GradientMethod method,
+                         size_t row_begin, size_t row_end,
+                         size_t col_begin, size_t col_end,
+                         gil::mat_view<gil::vec3f> guidance,
+                         gil::mat_view<gil::vec3f> iterate) {
+  switch (method) {
+    default:
+    case GradientMethod::BASE:
+      prepare_block_codes(f, g, codes, BaseGradient(), row_begin, row_end,
+                          col_begin, col_end, guidance, iterate);
+      break;
+
+    case GradientMethod::MAX_MIXING:
+      prepare_block_codes(f, g, codes, MixedGradient(), row_begin, row_end,
+                          col_begin, col_end, guidance, iterate);
+      break;
+
+    case GradientMethod::AVG_MIXING:
+      prepare_block_codes(f, g, codes, MixedGradientAvg(), row_begin, row_end,
+                          col_begin, col_end, guidance, iterate);
+      break;
+  }
+}
+
+/**
+ * Computes the |guidance| field and the first |iterate| of the poisson
+ * equation with the per-pixel boundary conditions |codes|, block by block.
+ */
+void prepare_codes(gil::mat_cview<gil::vec3f> f,
+                   gil::mat_cview<gil::vec3f> g,
+                   gil::mat_cview<uint8_t> codes,
+                   GradientMethod method,
+                   gil::mat_view<gil::vec3f> guidance,
+                   gil::mat_view<gil::vec3f> iterate) {
+  assert(f.size() == codes.size());
+  assert(g.size() == codes.size());
+  assert(guidance.size() == codes.size());
+  assert(iterate.size() == codes.size());
+  for (size_t i = 0; i < codes.rows(); i += kPrepareBlockRows) {
+    for (size_t j = 0; j < codes.cols(); j += kPrepareBlockCols) {
+      prepare_block_codes(f, g, codes, method,
+                          i, std::min(i + kPrepareBlockRows, codes.rows()),
+                          j, std::min(j + kPrepareBlockCols, codes.cols()),
+                          guidance, iterate);
+    }
+  }
+}
+
 /**
  * Function to execute one iteration of the iterative Jacobi method, applied to
  * the poisson equation. It calculates the left side of the equation and finds
@@ -227,6 +569,57 @@ void jacobi_iteration(gil::mat_cview<gil::vec3f> src,
   }
 }
 
+/**
+ * Same as jacobi_iteration, with the per-pixel boundary conditions |codes|
+ * and the guidance |b| of prepare_codes. Pixels on the image border are
+ * updated too. Dirichlet pixels are copied from |src|, so that both iterates
+ * keep their value.
+ */
+void jacobi_iteration_codes(gil::mat_cview<gil::vec3f> src,
+                            gil::mat_cview<gil::vec3f> b,
+                            gil::mat_cview<uint8_t> codes,
+                            gil::mat_view<gil::vec3f> dst) {
+  assert(src.size() == codes.size());
+  assert(b.size() == codes.size());
+  assert(dst.size() == codes.size());
+  jacobi_rows_codes(src, b, codes, 0, codes.rows(), dst);
+}
+
+/**
+ * Jacobi iteration of jacobi_iteration_codes over the rows [row_begin,
+ * row_end) only.
+ */
+void jacobi_rows_codes(gil::mat_cview<gil::vec3f> src,
+                       gil::mat_cview<gil::vec3f> b,
+                       gil::mat_cview<uint8_t> codes,
+                       size_t row_begin, size_t row_end,
+                       gil::mat_view<gil::vec3f> dst) {
+  size_t src_step = src.stride();
+  for (size_t i = row_begin; i < row_end; ++i) {
+    bool border_row = i == 0 || i == codes.rows()-1;
+    const gil::vec3f* src_it = src.row_cbegin(i);
+    const gil::vec3f* b_it = b.row_cbegin(i);
+    const uint8_t* codes_it = codes.row_cbegin(i);
+    gil::vec3f* dst_it = dst.row_begin(i);
+    for (size_t j = 0; j < codes.cols(); ++j, ++src_it, ++b_it, ++codes_it, ++dst_it) {
+      if (*codes_it == kDirichletCode) {
+        *dst_it = *src_it;
+      } else if (*codes_it == kUnknownCode && !border_row && j != 0 && j != codes.cols()-1) {
+        // same as jacobi_iteration, the boundary values being in |src|
+        *dst_it = (*b_it + src_it[-1] + src_it[1] + src_it[-src_step] + src_it[src_step]) / 4.0f;
+      } else {
+        int dirs[4];
+        size_t count = stencil(codes, i, j, dirs);
+        gil::vec3f sum = *b_it;
+        for (size_t k = 0; k < count; ++k)
+          sum += src_it[neighboor(dirs[k], src_step)];
+        // a pixel without any neighboor to read is left as is
+        *dst_it = count == 0 ? *src_it : sum / float(count);
+      }
+    }
+  }
+}
+
 /**
  * Deprecated function calculating the 2nd term of the left side of poisson
  * blending's equation.
@@ -291,3 +684,25 @@ void copy(gil::mat_cview<gil::vec3f> src,
     }
   }
 }
+
+/**
+ * Copies the pixels of |src| that are solved for according to |codes|, ie.
+ * all but the Dirichlet ones, to |dst|
+ */
+void copy_codes(gil::mat_cview<gil::vec3f> src,
+                gil::mat_cview<uint8_t> codes,
+                gil::mat_view<gil::vec3f> dst) {
+  assert(src.size() == codes.size());
+  assert(dst.size() == codes.size());
+
+  for (size_t i = 0; i < codes.rows(); ++i) {
+    const uint8_t* codes_it = codes.row_cbegin(i);
+    const gil::vec3f* src_it = src.row_cbegin(i);
+    gil::vec3f* dst_it = dst.row_begin(i);
+    for (size_t j = 0; j < codes.cols(); ++j, ++codes_it, ++src_it, ++dst_it) {
+      if (*codes_it != kDirichletCode) {
+        *dst_it = *src_it;
+      }
+    }
+  }
+}
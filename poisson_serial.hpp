@@ -6,8 +6,47 @@
 #include "gil/vec.hpp"
 #include "poisson.hpp"
 
+// Size of the blocks of the fused preparation pass, chosen so that the rows
+// of a block stay in cache while they are read as neighboors.
+const size_t kPrepareBlockRows = 32;
+const size_t kPrepareBlockCols = 512;
+
 gil::mat<uint8_t> make_boundary(gil::mat_cview<uint8_t> mask);
 
+void prepare(gil::mat_cview<gil::vec3f> f,
+             gil::mat_cview<gil::vec3f> g,
+             gil::mat_cview<uint8_t> mask,
+             GradientMethod method,
+             gil::mat_view<gil::vec3f> guidance,
+             gil::mat_view<gil::vec3f> iterate);
+
+void prepare_block(gil::mat_cview<gil::vec3f> f,
+                   gil::mat_cview<gil::vec3f> g,
+                   gil::mat_cview<uint8_t> mask,
+                   GradientMethod method,
+                   size_t row_begin, size_t row_end,
+                   size_t col_begin, size_t col_end,
+                   gil::mat_view<gil::vec3f> guidance,
+                   gil::mat_view<gil::vec3f> iterate);
+
+gil::mat<uint8_t> make_boundary_codes(gil::mat_cview<uint8_t> mask);
+
+void prepare_codes(gil::mat_cview<gil::vec3f> f,
+                   gil::mat_cview<gil::vec3f> g,
+                   gil::mat_cview<uint8_t> codes,
+                   GradientMethod method,
+                   gil::mat_view<gil::vec3f> guidance,
+                   gil::mat_view<gil::vec3f> iterate);
+
+void prepare_block_codes(gil::mat_cview<gil::vec3f> f,
+                         gil::mat_cview<gil::vec3f> g,
+                         gil::mat_cview<uint8_t> codes,
+                         GradientMethod method,
+                         size_t row_begin, size_t row_end,
+                         size_t col_begin, size_t col_end,
+                         gil::mat_view<gil::vec3f> guidance,
+                         gil::mat_view<gil::vec3f> iterate);
+
 gil::mat<gil::vec3f> make_guidance(gil::mat_cview<gil::vec3f> f,
                                    gil::mat_cview<gil::vec3f> g,
                                    gil::mat_cview<uint8_t> mask,
@@ -33,6 +72,17 @@ void jacobi_iteration(gil::mat_cview<gil::vec3f> src,
                       gil::mat_cview<uint8_t> mask,
                       gil::mat_view<gil::vec3f> dst);
 
+void jacobi_iteration_codes(gil::mat_cview<gil::vec3f> src,
+                            gil::mat_cview<gil::vec3f> b,
+                            gil::mat_cview<uint8_t> codes,
+                            gil::mat_view<gil::vec3f> dst);
+
+void jacobi_rows_codes(gil::mat_cview<gil::vec3f> src,
+                       gil::mat_cview<gil::vec3f> b,
+                       gil::mat_cview<uint8_t> codes,
+                       size_t row_begin, size_t row_end,
+                       gil::mat_view<gil::vec3f> dst);
+
 void apply_remainder(gil::mat_cview<gil::vec3f> src,
                      gil::mat_cview<uint8_t> mask,
                      gil::mat_view<gil::vec3f> dst);
@@ -45,6 +95,10 @@ void copy(gil::mat_cview<gil::vec3f> src,
           gil::mat_cview<uint8_t> mask,
           gil::mat_view<gil::vec4f> dst);
 
+void copy_codes(gil::mat_cview<gil::vec3f> src,
+                gil::mat_cview<uint8_t> codes,
+                gil::mat_view<gil::vec3f> dst);
+
 template <class T>
 void apply_mask(gil::mat_cview<uint8_t> mask, gil::mat_view<T> f) {
   for (int i = 0; i < f.rows(); ++i) {
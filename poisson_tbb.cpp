@@ -318,6 +318,102 @@ gil::mat<gil::vec3f> tbb_make_guidance_mixed_gradient_avg(gil::mat_cview<gil::ve
   return dst;
 }
 
+/**
+ * Class used by the parallel_for of the fused preparation pass, on 2d blocks
+ */
+class ParallelPrepare {
+public:
+  ParallelPrepare(const gil::mat_cview<gil::vec3f> f, const gil::mat_cview<gil::vec3f> g,
+    const gil::mat_cview<uint8_t> mask, GradientMethod method,
+    gil::mat_view<gil::vec3f> guidance, gil::mat_view<gil::vec3f> iterate)
+    : f_(f), g_(g), mask_(mask), method_(method), guidance_(guidance), iterate_(iterate) {
+    //empty, all in initialisation list
+  }
+
+  void operator()(const blocked_range2d<size_t>& range) const {
+    prepare_block(f_, g_, mask_, method_,
+                  range.rows().begin(), range.rows().end(),
+                  range.cols().begin(), range.cols().end(),
+                  guidance_, iterate_);
+  }
+
+private:
+  gil::mat_cview<gil::vec3f> f_;
+  gil::mat_cview<gil::vec3f> g_;
+  gil::mat_cview<uint8_t> mask_;
+  GradientMethod method_;
+  gil::mat_view<gil::vec3f> guidance_;
+  gil::mat_view<gil::vec3f> iterate_;
+};
+/**
+ * Computes the masked |guidance| field and the first |iterate| of the
+ * poisson equation in a single parallel pass over cache-sized blocks.
+ */
+void tbb_prepare(gil::mat_cview<gil::vec3f> f,
+                 gil::mat_cview<gil::vec3f> g,
+                 gil::mat_cview<uint8_t> mask,
+                 GradientMethod method,
+                 gil::mat_view<gil::vec3f> guidance,
+                 gil::mat_view<gil::vec3f> iterate) {
+  assert(f.size() == mask.size());
+  assert(g.size() == mask.size());
+  assert(guidance.size() == mask.size());
+  assert(iterate.size() == mask.size());
+  ParallelPrepare para_prepare(f, g, mask, method, guidance, iterate);
+  parallel_for(blocked_range2d<size_t>(0, mask.rows(), kPrepareBlockRows,
+                                       0, mask.cols(), kPrepareBlockCols),
+               para_prepare);
+}
+
+/**
+ * Class used by the parallel_for of the preparation pass with boundary codes,
+ * on 2d blocks
+ */
+class ParallelPrepareCodes {
+public:
+  ParallelPrepareCodes(const gil::mat_cview<gil::vec3f> f, const gil::mat_cview<gil::vec3f> g,
+    const gil::mat_cview<uint8_t> codes, GradientMethod method,
+    gil::mat_view<gil::vec3f> guidance, gil::mat_view<gil::vec3f> iterate)
+    : f_(f), g_(g), codes_(codes), method_(method), guidance_(guidance), iterate_(iterate) {
+    //empty, all in initialisation list
+  }
+
+  void operator()(const blocked_range2d<size_t>& range) const {
+    prepare_block_codes(f_, g_, codes_, method_,
+                        range.rows().begin(), range.rows().end(),
+                        range.cols().begin(), range.cols().end(),
+                        guidance_, iterate_);
+  }
+
+private:
+  gil::mat_cview<gil::vec3f> f_;
+  gil::mat_cview<gil::vec3f> g_;
+  gil::mat_cview<uint8_t> codes_;
+  GradientMethod method_;
+  gil::mat_view<gil::vec3f> guidance_;
+  gil::mat_view<gil::vec3f> iterate_;
+};
+/**
+ * Computes the |guidance| field and the first |iterate| of the poisson
+ * equation with the per-pixel boundary conditions |codes|, in a single
+ * parallel pass over cache-sized blocks.
+ */
+void tbb_prepare_codes(gil::mat_cview<gil::vec3f> f,
+                       gil::mat_cview<gil::vec3f> g,
+                       gil::mat_cview<uint8_t> codes,
+                       GradientMethod method,
+                       gil::mat_view<gil::vec3f> guidance,
+                       gil::mat_view<gil::vec3f> iterate) {
+  assert(f.size() == codes.size());
+  assert(g.size() == codes.size());
+  assert(guidance.size() == codes.size());
+  assert(iterate.size() == codes.size());
+  ParallelPrepareCodes para_prepare(f, g, codes, method, guidance, iterate);
+  parallel_for(blocked_range2d<size_t>(0, codes.rows(), kPrepareBlockRows,
+                                       0, codes.cols(), kPrepareBlockCols),
+               para_prepare);
+}
+
 /**
  * Class used by tbb to apply the parallel_for calculating the Jacobi iteration
  */
@@ -371,3 +467,41 @@ void tbb_jacobi_iteration(gil::mat_cview<gil::vec3f> src,
   ParallelJacobi para_jacobi(src, b, mask, dst);
   parallel_for(blocked_range<size_t>(1, src.rows()-1), para_jacobi);
 }
+
+/**
+ * Class used by tbb to apply the parallel_for calculating the Jacobi iteration
+ * with boundary codes
+ */
+class ParallelJacobiCodes {
+public:
+  ParallelJacobiCodes(const gil::mat_cview<gil::vec3f> src, const gil::mat_cview<gil::vec3f> b,
+    const gil::mat_cview<uint8_t> codes, gil::mat_view<gil::vec3f> dst)
+    : src_(src), b_(b), codes_(codes), dst_(dst) {
+    //empty, all in initialisation list
+  }
+
+  void operator()(const blocked_range<size_t>& range) const {
+    jacobi_rows_codes(src_, b_, codes_, range.begin(), range.end(), dst_);
+  }
+
+private:
+  gil::mat_cview<gil::vec3f> src_;
+  gil::mat_cview<gil::vec3f> b_;
+  gil::mat_cview<uint8_t> codes_;
+  gil::mat_view<gil::vec3f> dst_;
+};
+/**
+ * Same as tbb_jacobi_iteration, with the per-pixel boundary conditions
+ * |codes| and the guidance |b| of tbb_prepare_codes, see
+ * jacobi_iteration_codes.
+ */
+void tbb_jacobi_iteration_codes(gil::mat_cview<gil::vec3f> src,
+                                gil::mat_cview<gil::vec3f> b,
+                                gil::mat_cview<uint8_t> codes,
+                                gil::mat_view<gil::vec3f> dst) {
+  assert(src.size() == codes.size());
+  assert(b.size() == codes.size());
+  assert(dst.size() == codes.size());
+  ParallelJacobiCodes para_jacobi(src, b, codes, dst);
+  parallel_for(blocked_range<size_t>(0, codes.rows()), para_jacobi);
+}
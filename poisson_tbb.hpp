@@ -12,6 +12,20 @@
 
 gil::mat<uint8_t> tbb_make_boundary(gil::mat_cview<uint8_t> mask);
 
+void tbb_prepare(gil::mat_cview<gil::vec3f> f,
+                 gil::mat_cview<gil::vec3f> g,
+                 gil::mat_cview<uint8_t> mask,
+                 GradientMethod method,
+                 gil::mat_view<gil::vec3f> guidance,
+                 gil::mat_view<gil::vec3f> iterate);
+
+void tbb_prepare_codes(gil::mat_cview<gil::vec3f> f,
+                       gil::mat_cview<gil::vec3f> g,
+                       gil::mat_cview<uint8_t> codes,
+                       GradientMethod method,
+                       gil::mat_view<gil::vec3f> guidance,
+                       gil::mat_view<gil::vec3f> iterate);
+
 gil::mat<gil::vec3f> tbb_make_guidance(gil::mat_cview<gil::vec3f> f,
                                    gil::mat_cview<gil::vec3f> g,
                                    gil::mat_cview<uint8_t> mask,
@@ -38,6 +52,11 @@ void tbb_jacobi_iteration(gil::mat_cview<gil::vec3f> src,
                       gil::mat_cview<uint8_t> mask,
                       gil::mat_view<gil::vec3f> dst);
 
+void tbb_jacobi_iteration_codes(gil::mat_cview<gil::vec3f> src,
+                                gil::mat_cview<gil::vec3f> b,
+                                gil::mat_cview<uint8_t> codes,
+                                gil::mat_view<gil::vec3f> dst);
+
 
 /**
  * Class used by tbb to apply the parallel_for applying the mask